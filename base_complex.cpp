@@ -582,6 +582,7 @@ bool base_complex::base_complex_face_extraction(Singularity &si, Frame &frame, M
 
 		for (uint32_t j = 0; j < 4; j++) frame.FVs[frame.FFs[i].vs[j]].neighbor_ffs.push_back(i);
 	}
+	build_vs_index(frame.FEs, frame.FFs, frame.FE_index, frame.FF_index);
 
 	return true;
 }
@@ -637,17 +638,19 @@ void base_complex::base_complex_cuboid_extraction(Singularity &si, Frame &frame,
 		std::sort(frame.FHs[i].es.begin(), frame.FHs[i].es.end());
 		frame.FHs[i].es.erase(std::unique(frame.FHs[i].es.begin(), frame.FHs[i].es.end()), frame.FHs[i].es.end());
 		frame.FHs[i].vs= frame.FFs[frame.FHs[i].fs[0]].vs;
-		std::vector<uint32_t> vs = frame.FFs[frame.FHs[i].fs[0]].vs;
-		std::sort(vs.begin(), vs.end());
-		short cors_f = 1;
-		for (uint32_t j = 1; j < 6; j++) {
-			std::vector<uint32_t> vsj = frame.FFs[frame.FHs[i].fs[j]].vs;
-			std::sort(vsj.begin(), vsj.end());
-			std::vector<uint32_t> common_vs;
-			std::set_intersection(vs.begin(), vs.end(), vsj.begin(), vsj.end(), std::back_inserter(common_vs));
-			if (common_vs.size())continue; else { cors_f = j; break; }
+		//opposite slots, the only face sharing no corner; -1: none, a problematic cuboid
+		std::fill(frame.FHs[i].fs_op, frame.FHs[i].fs_op + 6, -1);
+		for (uint32_t j = 0; j < frame.FHs[i].fs.size() && j < 6; j++) {
+			const std::vector<uint32_t> &vsj = frame.FFs[frame.FHs[i].fs[j]].vs;
+			for (uint32_t k = 0; k < frame.FHs[i].fs.size() && k < 6; k++) {
+				if (k == j) continue;
+				const std::vector<uint32_t> &vsk = frame.FFs[frame.FHs[i].fs[k]].vs;
+				bool common = false;
+				for (auto vid : vsk) if (std::find(vsj.begin(), vsj.end(), vid) != vsj.end()) { common = true; break; }
+				if (!common) { frame.FHs[i].fs_op[j] = k; break; }
+			}
 		}
-		vs = frame.FFs[frame.FHs[i].fs[cors_f]].vs;
+		std::vector<uint32_t> vs = frame.FFs[frame.FHs[i].fs[frame.FHs[i].fs_op[0] < 0 ? 1 : frame.FHs[i].fs_op[0]]].vs;
 		for (uint32_t j = 0; j < 4; j++) {
 			std::vector<uint32_t> nvs = frame.FVs[frame.FHs[i].vs[j]].neighbor_fvs;
 			for (uint32_t k = 0; k < nvs.size(); k++)
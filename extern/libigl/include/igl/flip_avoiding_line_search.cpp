@@ -7,6 +7,7 @@
 // obtain one at http://mozilla.org/MPL/2.0/.
 #include "flip_avoiding_line_search.h"
 #include "line_search.h"
+#include "parallel_for.h"
 
 #include <Eigen/Dense>
 #include <vector>
@@ -270,27 +271,30 @@ namespace igl
 
     IGL_INLINE double compute_max_step_from_singularities(const Eigen::MatrixXd& uv,
                                                           const Eigen::MatrixXi& F,
-                                                          Eigen::MatrixXd& d)
+                                                          Eigen::MatrixXd& d,
+                                                          const size_t min_parallel)
     {
       using namespace std;
       double max_step = INFINITY;
+      // per thread minimum, reduced after the loop
+      std::vector<double> thread_min;
+      const auto & prep = [&](const size_t n) { thread_min.assign(n, INFINITY); };
+      const auto & accum = [&](const size_t t) { max_step = min(max_step, thread_min[t]); };
 
       // The if statement is outside the for loops to avoid branching/ease parallelizing
       if (uv.cols() == 2)
       {
-        for (int f = 0; f < F.rows(); f++)
+        igl::parallel_for(F.rows(), prep, [&](const int f, const size_t t)
         {
-          double min_positive_root = get_min_pos_root_2D(uv,F,d,f);
-          max_step = min(max_step, min_positive_root);
-        }
+          thread_min[t] = min(thread_min[t], get_min_pos_root_2D(uv,F,d,f));
+        }, accum, min_parallel);
       }
       else
       { // volumetric deformation
-        for (int f = 0; f < F.rows(); f++)
+        igl::parallel_for(F.rows(), prep, [&](const int f, const size_t t)
         {
-          double min_positive_root = get_min_pos_root_3D(uv,F,d,f);
-          max_step = min(max_step, min_positive_root);
-        }
+          thread_min[t] = min(thread_min[t], get_min_pos_root_3D(uv,F,d,f));
+        }, accum, min_parallel);
       }
       return max_step;
     }
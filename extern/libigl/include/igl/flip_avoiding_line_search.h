@@ -39,6 +39,23 @@ namespace igl
     std::function<double(Eigen::MatrixXd&)> energy,
     double cur_energy = -1);
 
+  namespace flip_avoiding
+  {
+    // Largest step along d before a triangle or tet of F degenerates, F.rows()
+    // below min_parallel runs serially.
+    //
+    // Inputs:
+    //   uv  #V by dim list of variables
+    //   F  #F by 3/4 list of mesh faces or tets
+    //   d  #V by dim list of step directions
+    //   min_parallel  minimum number of elements to run in parallel
+    // Returns the maximal step, INFINITY if no element flips
+    IGL_INLINE double compute_max_step_from_singularities(
+      const Eigen::MatrixXd& uv,
+      const Eigen::MatrixXi& F,
+      Eigen::MatrixXd& d,
+      const size_t min_parallel = 1000);
+  }
 }
 
 #ifndef IGL_STATIC_LIBRARY
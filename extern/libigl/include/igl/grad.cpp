@@ -259,7 +259,7 @@ IGL_INLINE void igl::grad(const Eigen::PlainObjectBase<DerivedV>&V,
 template <typename DerivedV, typename DerivedF>
 IGL_INLINE void grad_tet_ref(const Eigen::PlainObjectBase<DerivedV>&V,
 	const Eigen::PlainObjectBase<DerivedF>&T,
-	const std::vector<Eigen::MatrixXd>&RF,
+	const Eigen::Matrix<double, Eigen::Dynamic, 12, Eigen::RowMajor>&RF,
 	Eigen::SparseMatrix<typename DerivedV::Scalar> &G,
 	bool uniform) {
 	using namespace Eigen;
@@ -301,17 +301,17 @@ IGL_INLINE void grad_tet_ref(const Eigen::PlainObjectBase<DerivedV>&V,
 
 		for (int i = 0; i < m; i++) {
 			Vector3d e01, e02, e03;
-			e01 = RF[i].row(0) - RF[i].row(1);
-			e02 = RF[i].row(0) - RF[i].row(2);
-			e03 = RF[i].row(0) - RF[i].row(3); 
+			e01 = RF.row(i).segment<3>(0) - RF.row(i).segment<3>(3);
+			e02 = RF.row(i).segment<3>(0) - RF.row(i).segment<3>(6);
+			e03 = RF.row(i).segment<3>(0) - RF.row(i).segment<3>(9);
 			double volume_i = std::abs(e01.cross(e02).dot(e03))/6;
 			double scale_i = vol(i) / volume_i;
 			scale_i = std::cbrt(scale_i);
 
 			for (int k = 0; k < 4; k++) {
 				Vector3d e0, e1;
-				e0 = (RF[i].row(tet_faces[k][0]) - RF[i].row(tet_faces[k][1])) *scale_i;
-				e1 = (RF[i].row(tet_faces[k][0]) - RF[i].row(tet_faces[k][2])) *scale_i;
+				e0 = (RF.row(i).segment<3>(3 * tet_faces[k][0]) - RF.row(i).segment<3>(3 * tet_faces[k][1])) *scale_i;
+				e1 = (RF.row(i).segment<3>(3 * tet_faces[k][0]) - RF.row(i).segment<3>(3 * tet_faces[k][2])) *scale_i;
 
 				double area = e0.cross(e1).norm() / 2;
 				A(k * m + i) = area;
@@ -362,7 +362,7 @@ IGL_INLINE void grad_tet_ref(const Eigen::PlainObjectBase<DerivedV>&V,
 template <typename DerivedV, typename DerivedF>
 IGL_INLINE void igl::grad_ref(const Eigen::PlainObjectBase<DerivedV>&V,
 	const Eigen::PlainObjectBase<DerivedF>&F,
-	const std::vector<Eigen::MatrixXd>&RF,
+	const Eigen::Matrix<double, Eigen::Dynamic, 12, Eigen::RowMajor>&RF,
 	Eigen::SparseMatrix<typename DerivedV::Scalar> &G,
 	bool uniform)
 {
@@ -378,6 +378,6 @@ IGL_INLINE void igl::grad_ref(const Eigen::PlainObjectBase<DerivedV>&V,
 // Explicit template specialization
 template void igl::grad<Eigen::Matrix<double, -1, -1, 0, -1, -1>, Eigen::Matrix<int, -1, -1, 0, -1, -1> >(Eigen::PlainObjectBase<Eigen::Matrix<double, -1, -1, 0, -1, -1> > const&, Eigen::PlainObjectBase<Eigen::Matrix<int, -1, -1, 0, -1, -1> > const&, Eigen::SparseMatrix<Eigen::Matrix<double, -1, -1, 0, -1, -1>::Scalar, 0, int>&, bool);
 template void igl::grad<Eigen::Matrix<double, -1, 3, 0, -1, 3>, Eigen::Matrix<int, -1, 3, 0, -1, 3> >(Eigen::PlainObjectBase<Eigen::Matrix<double, -1, 3, 0, -1, 3> > const&, Eigen::PlainObjectBase<Eigen::Matrix<int, -1, 3, 0, -1, 3> > const&, Eigen::SparseMatrix<Eigen::Matrix<double, -1, 3, 0, -1, 3>::Scalar, 0, int>&, bool);
-template void igl::grad_ref<class Eigen::Matrix<double, -1, -1, 0, -1, -1>, class Eigen::Matrix<int, -1, -1, 0, -1, -1> >(class Eigen::PlainObjectBase<class Eigen::Matrix<double, -1, -1, 0, -1, -1> > const &, class Eigen::PlainObjectBase<class Eigen::Matrix<int, -1, -1, 0, -1, -1> > const &, class std::vector<class Eigen::Matrix<double, -1, -1, 0, -1, -1>, class std::allocator<class Eigen::Matrix<double, -1, -1, 0, -1, -1> > > const &, class Eigen::SparseMatrix<double, 0, int> &, bool);
+template void igl::grad_ref<class Eigen::Matrix<double, -1, -1, 0, -1, -1>, class Eigen::Matrix<int, -1, -1, 0, -1, -1> >(class Eigen::PlainObjectBase<class Eigen::Matrix<double, -1, -1, 0, -1, -1> > const &, class Eigen::PlainObjectBase<class Eigen::Matrix<int, -1, -1, 0, -1, -1> > const &, class Eigen::Matrix<double, -1, 12, 1, -1, 12> const &, class Eigen::SparseMatrix<double, 0, int> &, bool);
 
 #endif
@@ -42,7 +42,7 @@ IGL_INLINE void grad(const Eigen::PlainObjectBase<DerivedV>&V,
 template <typename DerivedV, typename DerivedF>
 IGL_INLINE void grad_ref(const Eigen::PlainObjectBase<DerivedV>&V,
 	const Eigen::PlainObjectBase<DerivedF>&F,
-	const std::vector<Eigen::MatrixXd>&RF,
+	const Eigen::Matrix<double, Eigen::Dynamic, 12, Eigen::RowMajor>&RF,
 	Eigen::SparseMatrix<typename DerivedV::Scalar> &G,
 	bool uniform);
 }
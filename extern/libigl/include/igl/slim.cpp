@@ -24,11 +24,13 @@
 #include "volume.h"
 #include "polar_svd.h"
 #include "flip_avoiding_line_search.h"
+#include "parallel_for.h"
 
 #include <iostream>
 #include <map>
 #include <set>
 #include <vector>
+#include <limits>
 
 #include <Eigen/IterativeLinearSolvers>
 #include <Eigen/SparseCholesky>
@@ -67,7 +69,43 @@ namespace igl
                                                           Eigen::MatrixXd &uv);
     IGL_INLINE void compute_jacobians(igl::SLIMData& s, const Eigen::MatrixXd &uv);
     IGL_INLINE void build_linear_system(igl::SLIMData& s, Eigen::SparseMatrix<double> &L);
-    IGL_INLINE void pre_calc(igl::SLIMData& s);
+    IGL_INLINE bool pattern_matches(const igl::SLIMData& s);
+    IGL_INLINE void build_pattern(igl::SLIMData& s);
+    IGL_INLINE void update_pattern(igl::SLIMData& s);
+    IGL_INLINE void assemble_linear_system(igl::SLIMData& s);
+
+    // per-tet data shared by the assembled and the matrix-free 3D solves
+    struct SLIMTetTerms
+    {
+      Eigen::Matrix<double, Eigen::Dynamic, 18, Eigen::RowMajor> WW; // M W^T W, M W^T (W R^T), row-major
+    };
+    IGL_INLINE void tet_terms(igl::SLIMData& s, SLIMTetTerms &tt);
+    // L of build_linear_system as an operator for Eigen's conjugate_gradient
+    struct SLIMOperator
+    {
+      const igl::SLIMData &s;
+      const SLIMTetTerms &tt;
+      Eigen::VectorXd diag; // constraint diagonal
+      std::vector<Eigen::Triplet<double> > extra; // off-diagonal constraint couplings
+      SLIMOperator(const igl::SLIMData &s_, const SLIMTetTerms &tt_) : s(s_), tt(tt_) {}
+      int rows() const { return diag.size(); }
+      int cols() const { return diag.size(); }
+      Eigen::VectorXd operator*(const Eigen::VectorXd &x) const;
+    };
+    struct SLIMJacobi
+    {
+      Eigen::VectorXd inv_diag;
+      Eigen::VectorXd solve(const Eigen::VectorXd &r) const { return inv_diag.cwiseProduct(r); }
+    };
+    IGL_INLINE void solve_matrix_free(igl::SLIMData& s, const Eigen::VectorXd &guess, Eigen::VectorXd &Uc);
+    IGL_INLINE void tet_gradients(igl::SLIMData& s);
+    IGL_INLINE double energy_3d(const igl::SLIMData& s, double s1, double s2, double s3);
+    IGL_INLINE Eigen::Matrix3d tet_jacobian(const igl::SLIMData& s, const Eigen::MatrixXd &uv, int t);
+    IGL_INLINE double tet_energy_at(const igl::SLIMData& s, const Eigen::MatrixXd &uv, int t);
+    IGL_INLINE double compute_tet_energies(igl::SLIMData& s);
+    IGL_INLINE double line_search_3d(igl::SLIMData& s, Eigen::MatrixXd &dst);
+    IGL_INLINE void anderson_step(igl::SLIMData& s, const Eigen::MatrixXd &x0);
+    IGL_INLINE void pre_calc(igl::SLIMData& s, const Eigen::Matrix<double, Eigen::Dynamic, 12, Eigen::RowMajor> &RF);
 
     // Implementation
     IGL_INLINE void compute_surface_gradient_matrix(const Eigen::MatrixXd &V, const Eigen::MatrixXi &F,
@@ -396,7 +434,8 @@ namespace igl
 	 // Timer<> time0;
 	  //time0.beginStage("build L");
       Eigen::SparseMatrix<double> L;
-      build_linear_system(s,L);
+      if (s.dim == 2) build_linear_system(s,L);
+      else if (!s.matrix_free) assemble_linear_system(s);
 	  //time0.endStage("end build L");
 	  //time0.beginStage("solve L");
       // solve
@@ -408,16 +447,24 @@ namespace igl
       }
       else
       { // seems like CG performs much worse for 2D and way better for 3D
-		  uint32_t Num_variables = uv.rows() * s.dim + s.ids_L.rows();
-		  if (s.Projection) Num_variables = uv.rows() * s.dim;
-
-        Eigen::VectorXd guess(Num_variables);
+        update_pattern(s);
+        const SLIMPattern &p = *s.pattern;
+        Eigen::VectorXd guess(p.n);
         for (int i = 0; i < s.v_n; i++) for (int j = 0; j < s.dim; j++) guess(uv.rows() * j + i) = uv(i, j); // flatten vector
-		if(!s.Projection)
-			for (int i = 0; i < s.ids_L.rows(); i++) guess(uv.rows() * s.dim + i) = 0;//feature curve additional variable
-        ConjugateGradient<Eigen::SparseMatrix<double>, Eigen::Lower | Upper> solver;
-        solver.setTolerance(1e-8);
-        Uc = solver.compute(L).solveWithGuess(s.rhs, guess);
+		for (int i = 0; i < p.aux_n; i++) guess(uv.rows() * s.dim + i) = 0;//feature curve additional variable
+		for (uint32_t g = 0; g < s.Vgroups.size(); g++) {//group means
+			Eigen::RowVector3d m(0, 0, 0);
+			for (auto v : s.Vgroups[g]) m += uv.row(v);
+			if (!s.Vgroups[g].empty()) m /= s.Vgroups[g].size();
+			for (int d = 0; d < 3; d++) guess(3 * s.v_n + p.aux_n + 3 * g + d) = m(d);
+		}
+        if (s.matrix_free) solve_matrix_free(s, guess, Uc);
+        else
+        {
+          ConjugateGradient<Eigen::SparseMatrix<double>, Eigen::Lower | Upper> solver;
+          solver.setTolerance(1e-8);
+          Uc = solver.compute(s.pattern->L).solveWithGuess(s.rhs, guess);
+        }
       }
 
       for (int i = 0; i < s.dim; i++)
@@ -431,7 +478,7 @@ namespace igl
     }
 
 
-    IGL_INLINE void pre_calc(igl::SLIMData& s)
+    IGL_INLINE void pre_calc(igl::SLIMData& s, const Eigen::Matrix<double, Eigen::Dynamic, 12, Eigen::RowMajor> &RF)
     {
       if (!s.has_pre_calc)
       {
@@ -454,7 +501,7 @@ namespace igl
         {
           s.dim = 3;
           Eigen::SparseMatrix<double> G;
-          igl::grad_ref(s.V, s.F,s.RF, G,
+          igl::grad_ref(s.V, s.F, RF, G,
                     s.mesh_improvement_3d /*use normal gradient, or one from a "regular" tet*/);
           s.Dx = G.block(0, 0, s.F.rows(), s.V.rows());
           s.Dy = G.block(s.F.rows(), 0, s.F.rows(), s.V.rows());
@@ -475,6 +522,7 @@ namespace igl
         s.Dx.makeCompressed();
         s.Dy.makeCompressed();
         s.Dz.makeCompressed();
+        if (s.dim == 3) tet_gradients(s);
         s.Ri.resize(s.f_n, s.dim * s.dim);
         s.Ji.resize(s.f_n, s.dim * s.dim);
         s.rhs.resize(s.dim * s.v_num);
@@ -524,6 +572,327 @@ namespace igl
 
     }
 
+    IGL_INLINE bool pattern_matches(const igl::SLIMData& s)
+    {
+      const SLIMPattern &p = *s.pattern;
+      int aux_n = s.Projection ? 0 : s.ids_L.rows();
+      return p.v_n == s.v_n && p.aux_n == aux_n && p.Vgroups == s.Vgroups && p.assembled == !s.matrix_free &&
+        p.F.rows() == s.F.rows() && p.F == s.F;
+    }
+
+    IGL_INLINE void build_pattern(igl::SLIMData& s)
+    {
+      SLIMPattern &p = *s.pattern;
+      int v_n = s.v_n, f_n = s.f_n;
+      p.F = s.F; p.v_n = v_n; p.Vgroups = s.Vgroups;
+      p.aux_n = s.Projection ? 0 : s.ids_L.rows();
+      p.assembled = !s.matrix_free;
+      int n = p.n = 3 * v_n + p.aux_n + 3 * s.Vgroups.size();
+      int group_base = 3 * v_n + p.aux_n;
+
+      p.vt_start.setZero(v_n + 1);
+      for (int t = 0; t < f_n; t++) for (int k = 0; k < 4; k++) p.vt_start(s.F(t, k) + 1)++;
+      for (int u = 0; u < v_n; u++) p.vt_start(u + 1) += p.vt_start(u);
+      p.vt.resize(4 * f_n);
+      Eigen::VectorXi fill = p.vt_start.head(v_n);
+      for (int t = 0; t < f_n; t++) for (int k = 0; k < 4; k++) p.vt(fill(s.F(t, k))++) = 4 * t + k;
+      if (!p.assembled)
+      {
+        p.L = Eigen::SparseMatrix<double>();
+        p.deg.resize(0); p.diag_pos.resize(0); p.tet_pos.resize(0, 16);
+        return;
+      }
+
+      // one-rings; a coincidence group couples its vertices only to its mean variable
+      std::vector<std::vector<int> > adj(v_n), aux(v_n), grp(v_n), members(s.Vgroups.size());
+      for (int t = 0; t < f_n; t++)
+        for (int j = 0; j < 4; j++)
+          for (int k = 0; k < 4; k++) adj[s.F(t, j)].push_back(s.F(t, k));
+      for (int u = 0; u < v_n; u++) adj[u].push_back(u);
+      for (uint32_t g = 0; g < s.Vgroups.size(); g++)
+      {
+        members[g].assign(s.Vgroups[g].begin(), s.Vgroups[g].end());
+        std::sort(members[g].begin(), members[g].end());
+        members[g].erase(std::unique(members[g].begin(), members[g].end()), members[g].end());
+        for (int v : members[g]) grp[v].push_back(g);
+      }
+      p.deg.resize(v_n); p.diag_pos.resize(v_n);
+      for (int u = 0; u < v_n; u++)
+      {
+        std::sort(adj[u].begin(), adj[u].end());
+        adj[u].erase(std::unique(adj[u].begin(), adj[u].end()), adj[u].end());
+        p.deg(u) = adj[u].size();
+        p.diag_pos(u) = std::lower_bound(adj[u].begin(), adj[u].end(), u) - adj[u].begin();
+      }
+      for (int i = 0; i < p.aux_n; i++) aux[s.ids_L(i)].push_back(3 * v_n + i);
+
+      // compressed columns written in place
+      int nnz = 4 * p.aux_n;
+      for (int u = 0; u < v_n; u++) nnz += 3 * (3 * p.deg(u) + aux[u].size() + grp[u].size());
+      for (auto &m : members) nnz += 3 * (m.size() + 1);
+      p.L.resize(n, n);
+      p.L.resizeNonZeros(nnz);
+      int *outer = p.L.outerIndexPtr(), *inner = p.L.innerIndexPtr(), z = 0;
+      for (int c = 0; c < 3; c++)
+        for (int u = 0; u < v_n; u++)
+        {
+          outer[c * v_n + u] = z;
+          for (int r = 0; r < 3; r++) for (int w : adj[u]) inner[z++] = r * v_n + w;
+          for (int a : aux[u]) inner[z++] = a;
+          for (int g : grp[u]) inner[z++] = group_base + 3 * g + c;
+        }
+      for (int i = 0; i < p.aux_n; i++)
+      {
+        outer[3 * v_n + i] = z;
+        for (int d = 0; d < 3; d++) inner[z++] = d * v_n + s.ids_L(i);
+        inner[z++] = 3 * v_n + i;
+      }
+      for (uint32_t g = 0; g < members.size(); g++)
+        for (int d = 0; d < 3; d++)
+        {
+          outer[group_base + 3 * g + d] = z;
+          for (int v : members[g]) inner[z++] = d * v_n + v;
+          inner[z++] = group_base + 3 * g + d;
+        }
+      outer[n] = z;
+
+      p.tet_pos.resize(f_n, 16);
+      for (int t = 0; t < f_n; t++)
+        for (int j = 0; j < 4; j++)
+          for (int k = 0; k < 4; k++)
+          {
+            std::vector<int> &ring = adj[s.F(t, k)];
+            p.tet_pos(t, 4 * j + k) = std::lower_bound(ring.begin(), ring.end(), s.F(t, j)) - ring.begin();
+          }
+    }
+
+    IGL_INLINE void update_pattern(igl::SLIMData& s)
+    {
+      if (!s.pattern) s.pattern = std::make_shared<SLIMPattern>();
+      if (!pattern_matches(s)) build_pattern(s);
+    }
+
+    IGL_INLINE void tet_gradients(igl::SLIMData& s)
+    {
+      s.tet_grad.setZero(s.f_n, 12);
+      const Eigen::SparseMatrix<double> *D[3] = { &s.Dx, &s.Dy, &s.Dz };
+      for (int b = 0; b < 3; b++)
+        for (int v = 0; v < D[b]->outerSize(); v++)
+          for (Eigen::SparseMatrix<double>::InnerIterator it(*D[b], v); it; ++it)
+            for (int j = 0; j < 4; j++)
+              if (s.F(it.row(), j) == v) { s.tet_grad(it.row(), 4 * b + j) += it.value(); break; }
+    }
+
+    // per tet: the weights of formulas (35)/(36) folded to M W^T W and M W^T (W R^T);
+    // the rhs of the tet terms is gathered per vertex
+    IGL_INLINE void tet_terms(igl::SLIMData& s, SLIMTetTerms &tt)
+    {
+      update_pattern(s);
+      SLIMPattern &p = *s.pattern;
+      int v_n = s.v_n, f_n = s.f_n;
+
+      tt.WW.resize(f_n, 18);
+      igl::parallel_for(f_n, [&](const int t)
+      {
+        Eigen::Matrix3d W, R;
+        W << s.W_11(t), s.W_12(t), s.W_13(t),
+             s.W_21(t), s.W_22(t), s.W_23(t),
+             s.W_31(t), s.W_32(t), s.W_33(t);
+        for (int b = 0; b < 3; b++) for (int k = 0; k < 3; k++) R(b, k) = s.Ri(t, 3 * b + k);
+        Eigen::Matrix<double, 3, 3, Eigen::RowMajor> WtW = s.M(t) * W.transpose() * W;
+        Eigen::Matrix<double, 3, 3, Eigen::RowMajor> Wtf = s.M(t) * W.transpose() * (W * R.transpose());
+        for (int i = 0; i < 9; i++) { tt.WW(t, i) = WtW.data()[i]; tt.WW(t, 9 + i) = Wtf.data()[i]; }
+      }, s.min_parallel);
+
+      s.rhs.setZero(p.n);
+      igl::parallel_for(v_n, [&](const int u)
+      {
+        for (int q = p.vt_start(u); q < p.vt_start(u + 1); q++)
+        {
+          int t = p.vt(q) / 4, k = p.vt(q) % 4;
+          for (int c = 0; c < 3; c++)
+            for (int b = 0; b < 3; b++) s.rhs(c * v_n + u) += tt.WW(t, 9 + 3 * c + b) * s.tet_grad(t, 4 * b + k);
+        }
+      }, s.min_parallel);
+    }
+
+    // proximal term and soft constraints of build_linear_system, as add(row, col, value) and into the rhs
+    template <typename AddFunc>
+    IGL_INLINE void constraint_terms(igl::SLIMData& s, int aux_n, const AddFunc &add)
+    {
+      int v_n = s.v_n;
+      for (int c = 0; c < 3; c++)
+        for (int u = 0; u < v_n; u++)
+        {
+          add(c * v_n + u, c * v_n + u, s.proximal_p);
+          s.rhs(c * v_n + u) += s.proximal_p * s.V_o(u, c);
+        }
+      double soft_p = s.Projection ? s.lamda_C : s.soft_const_p;
+      for (int d = 0; d < 3; d++)
+        for (int i = 0; i < s.b.rows(); i++)
+        {
+          add(d * v_n + s.b(i), d * v_n + s.b(i), soft_p);
+          s.rhs(d * v_n + s.b(i)) += soft_p * s.bc(i, d);
+        }
+      // sum_{j<k} |x_j - x_k|^2 = n * min_m sum_j |x_j - m|^2: the all-pairs penalty
+      // of a group of n through its mean variable m, with the same minimizer
+      for (uint32_t g = 0; g < s.Vgroups.size(); g++)
+      {
+        double w = s.soft_const_p * s.Vgroups[g].size();
+        for (int d = 0; d < 3; d++)
+        {
+          int m = s.pattern->n - 3 * s.Vgroups.size() + 3 * g + d;
+          for (auto v : s.Vgroups[g])
+          {
+            add(d * v_n + v, d * v_n + v, w);
+            add(d * v_n + v, m, -w); add(m, d * v_n + v, -w);
+            add(m, m, w);
+          }
+        }
+      }
+      for (int d = 0; d < 3; d++)
+        for (int i = 0; i < s.regionb.rows(); i++)
+        {
+          add(d * v_n + s.regionb(i), d * v_n + s.regionb(i), s.lamda_region);
+          s.rhs(d * v_n + s.regionb(i)) += s.lamda_region * s.regionbc(i, d);
+        }
+      if (s.Projection) return;
+      for (int d = 0; d < 3; d++)
+        for (int i = 0; i < s.ids_C.rows(); i++)
+        {
+          add(d * v_n + s.ids_C(i), d * v_n + s.ids_C(i), s.lamda_C);
+          s.rhs(d * v_n + s.ids_C(i)) += s.lamda_C * s.C(i, d);
+        }
+      for (int i = 0; i < s.ids_T.rows(); i++)
+      {
+        int vid = s.ids_T(i);
+        for (int c = 0; c < 3; c++)
+        {
+          for (int c2 = 0; c2 < 3; c2++) add(c * v_n + vid, c2 * v_n + vid, s.lamda_T * s.normal_T(i, c) * s.normal_T(i, c2));
+          s.rhs(c * v_n + vid) += s.lamda_T * s.normal_T(i, c) * s.dis_T(i);
+        }
+      }
+      for (int i = 0; i < aux_n; i++)
+      {
+        int vid = s.ids_L(i), a = 3 * v_n + i;
+        for (int d = 0; d < 3; d++)
+        {
+          add(d * v_n + vid, d * v_n + vid, s.lamda_L);
+          add(d * v_n + vid, a, -s.lamda_L * s.Axa_L(i, d));
+          add(a, d * v_n + vid, -s.lamda_L * s.Axa_L(i, d));
+          add(a, a, s.lamda_L * s.Axa_L(i, d) * s.Axa_L(i, d));
+          s.rhs(d * v_n + vid) += s.lamda_L * s.origin_L(i, d);
+          s.rhs(a) -= s.lamda_L * s.Axa_L(i, d) * s.origin_L(i, d);
+        }
+      }
+    }
+
+    // L = At * W * A + proximal_p * I plus the soft constraints (build_linear_system),
+    // gathered per tet into the fixed pattern: no A, no sparse products
+    IGL_INLINE void assemble_linear_system(igl::SLIMData& s)
+    {
+      SLIMTetTerms tt;
+      tet_terms(s, tt);
+      SLIMPattern &p = *s.pattern;
+      int v_n = s.v_n;
+
+      double *val = p.L.valuePtr();
+      const int *outer = p.L.outerIndexPtr(), *inner = p.L.innerIndexPtr();
+      std::fill(val, val + p.L.nonZeros(), 0.0);
+      // each vertex owns its 3 columns: no write conflicts
+      igl::parallel_for(v_n, [&](const int u)
+      {
+        for (int q = p.vt_start(u); q < p.vt_start(u + 1); q++)
+        {
+          int t = p.vt(q) / 4, k = p.vt(q) % 4;
+          for (int j = 0; j < 4; j++)
+          {
+            double g = 0;
+            for (int b = 0; b < 3; b++) g += s.tet_grad(t, 4 * b + j) * s.tet_grad(t, 4 * b + k);
+            if (g == 0) continue;
+            int pos = p.tet_pos(t, 4 * j + k);
+            for (int c2 = 0; c2 < 3; c2++)
+              for (int c = 0; c < 3; c++) val[outer[c2 * v_n + u] + c * p.deg(u) + pos] += tt.WW(t, 3 * c + c2) * g;
+          }
+        }
+      }, s.min_parallel);
+
+      constraint_terms(s, p.aux_n, [&](int row, int col, double v)
+      {
+        if (row == col && row < 3 * v_n)
+        {
+          int u = row % v_n;
+          val[outer[row] + (row / v_n) * p.deg(u) + p.diag_pos(u)] += v;
+        }
+        else val[std::lower_bound(inner + outer[col], inner + outer[col + 1], row) - inner] += v;
+      });
+    }
+
+    // L * x streamed over the tets: per vertex, gather the incident tets' couplings
+    IGL_INLINE Eigen::VectorXd SLIMOperator::operator*(const Eigen::VectorXd &x) const
+    {
+      const SLIMPattern &p = *s.pattern;
+      int v_n = s.v_n;
+      Eigen::VectorXd y = diag.cwiseProduct(x);
+      igl::parallel_for(v_n, [&](const int u)
+      {
+        double yu[3] = { 0, 0, 0 };
+        for (int q = p.vt_start(u); q < p.vt_start(u + 1); q++)
+        {
+          int t = p.vt(q) / 4, k = p.vt(q) % 4;
+          double wx[3] = { 0, 0, 0 };
+          for (int j = 0; j < 4; j++)
+          {
+            double g = 0;
+            for (int b = 0; b < 3; b++) g += s.tet_grad(t, 4 * b + j) * s.tet_grad(t, 4 * b + k);
+            int w = s.F(t, j);
+            for (int c = 0; c < 3; c++) wx[c] += g * x(c * v_n + w);
+          }
+          for (int c2 = 0; c2 < 3; c2++)
+            for (int c = 0; c < 3; c++) yu[c2] += tt.WW(t, 3 * c + c2) * wx[c];
+        }
+        for (int c = 0; c < 3; c++) y(c * v_n + u) += yu[c];
+      }, s.min_parallel);
+      for (auto &e : extra) y(e.row()) += e.value() * x(e.col());
+      return y;
+    }
+
+    // CG on L without assembling it; same tolerance and preconditioner as the assembled solve
+    IGL_INLINE void solve_matrix_free(igl::SLIMData& s, const Eigen::VectorXd &guess, Eigen::VectorXd &Uc)
+    {
+      SLIMTetTerms tt;
+      tet_terms(s, tt);
+      int v_n = s.v_n, n = s.pattern->n;
+      SLIMOperator L(s, tt);
+      L.diag.setZero(n);
+      constraint_terms(s, s.pattern->aux_n, [&](int row, int col, double v)
+      {
+        if (row == col) L.diag(row) += v;
+        else L.extra.push_back(Eigen::Triplet<double>(row, col, v));
+      });
+
+      // jacobi preconditioner: constraint diagonal plus the tet diagonal
+      Eigen::VectorXd d = L.diag;
+      igl::parallel_for(v_n, [&](const int u)
+      {
+        const SLIMPattern &p = *s.pattern;
+        for (int q = p.vt_start(u); q < p.vt_start(u + 1); q++)
+        {
+          int t = p.vt(q) / 4, k = p.vt(q) % 4;
+          double g = 0;
+          for (int b = 0; b < 3; b++) g += s.tet_grad(t, 4 * b + k) * s.tet_grad(t, 4 * b + k);
+          for (int c = 0; c < 3; c++) d(c * v_n + u) += tt.WW(t, 4 * c) * g;
+        }
+      }, s.min_parallel);
+      SLIMJacobi jacobi;
+      jacobi.inv_diag = d.unaryExpr([](double v) { return v != 0 ? 1.0 / v : 1.0; });
+
+      Uc = guess;
+      int iters = 2 * n;
+      double tol = 1e-8;
+      Eigen::internal::conjugate_gradient(L, s.rhs, Uc, jacobi, iters, tol);
+    }
+
     IGL_INLINE void add_soft_constraints(igl::SLIMData& s, Eigen::SparseMatrix<double> &L)
     {
       int v_n = s.v_num;
@@ -556,8 +925,8 @@ namespace igl
 			  for (uint32_t j = 0; j<s.Vgroups[i].size(); j++)
 				  for (uint32_t k = j + 1; k < s.Vgroups[i].size(); k++) {
 					  for (int d = 0; d < s.dim; d++) {
-						  equality.push_back(Eigen::Triplet<double>(s.dim * cn + d, d*s.v_num + j, 1));
-						  equality.push_back(Eigen::Triplet<double>(s.dim * cn + d, d*s.v_num + k, -1));
+						  equality.push_back(Eigen::Triplet<double>(s.dim * cn + d, d*s.v_num + s.Vgroups[i][j], 1));
+						  equality.push_back(Eigen::Triplet<double>(s.dim * cn + d, d*s.v_num + s.Vgroups[i][k], -1));
 						  b[s.dim * cn + d] = 0;
 					  }
 					  cn++;
@@ -670,13 +1039,15 @@ namespace igl
 		  }
 	  }
 	  {
-		  //add equality
+		  //add equality, all pairs as n times the spread about the group mean
 		  for (uint32_t i = 0; i < s.Vgroups.size(); i++) {
-			  for (uint32_t j = 0; j < s.Vgroups[i].size(); j++) {
-				  for (uint32_t k = j + 1; k < s.Vgroups[i].size(); k++) {
-					  e += s.soft_const_p * (V_o.row(s.Vgroups[i][j]) - V_o.row(s.Vgroups[i][k])).squaredNorm();
-				  }
-			  }
+			  if (s.Vgroups[i].empty()) continue;
+			  Eigen::RowVectorXd m = Eigen::RowVectorXd::Zero(V_o.cols());
+			  for (auto v : s.Vgroups[i]) m += V_o.row(v);
+			  m /= s.Vgroups[i].size();
+			  double spread = 0;
+			  for (auto v : s.Vgroups[i]) spread += (V_o.row(v) - m).squaredNorm();
+			  e += s.soft_const_p * s.Vgroups[i].size() * spread;
 		  }
 	  }
 	  {//localize region
@@ -790,50 +1161,157 @@ namespace igl
           Mat3 ri, ti, ui, vi;
           Vec3 sing;
           igl::polar_svd(ji, ri, ti, ui, sing, vi);
-          double s1 = sing(0);
-          double s2 = sing(1);
-          double s3 = sing(2);
-
-          switch (s.slim_energy)
-          {
-            case igl::SLIMData::ARAP:
-            {
-              energy += areas(i) * (pow(s1 - 1, 2) + pow(s2 - 1, 2) + pow(s3 - 1, 2));
-              break;
-            }
-            case igl::SLIMData::SYMMETRIC_DIRICHLET:
-            {
-              energy += areas(i) * (pow(s1, 2) + pow(s1, -2) + pow(s2, 2) + pow(s2, -2) + pow(s3, 2) + pow(s3, -2));
-              break;
-            }
-            case igl::SLIMData::EXP_SYMMETRIC_DIRICHLET:
-            {
-              energy += areas(i) * exp(s.exp_factor *
-                                       (pow(s1, 2) + pow(s1, -2) + pow(s2, 2) + pow(s2, -2) + pow(s3, 2) + pow(s3, -2)));
-              break;
-            }
-            case igl::SLIMData::LOG_ARAP:
-            {
-              energy += areas(i) * (pow(log(s1), 2) + pow(log(std::abs(s2)), 2) + pow(log(std::abs(s3)), 2));
-              break;
-            }
-            case igl::SLIMData::CONFORMAL:
-            {
-              energy += areas(i) * ((pow(s1, 2) + pow(s2, 2) + pow(s3, 2)) / (3 * pow(s1 * s2 * s3, 2. / 3.)));
-              break;
-            }
-            case igl::SLIMData::EXP_CONFORMAL:
-            {
-              energy += areas(i) * exp((pow(s1, 2) + pow(s2, 2) + pow(s3, 2)) / (3 * pow(s1 * s2 * s3, 2. / 3.)));
-              break;
-            }
-          }
+          energy += areas(i) * energy_3d(s, sing(0), sing(1), sing(2));
         }
       }
 
       return energy;
     }
 
+    IGL_INLINE double energy_3d(const igl::SLIMData& s, double s1, double s2, double s3)
+    {
+      switch (s.slim_energy)
+      {
+        case igl::SLIMData::ARAP:
+          return pow(s1 - 1, 2) + pow(s2 - 1, 2) + pow(s3 - 1, 2);
+        case igl::SLIMData::SYMMETRIC_DIRICHLET:
+          return pow(s1, 2) + pow(s1, -2) + pow(s2, 2) + pow(s2, -2) + pow(s3, 2) + pow(s3, -2);
+        case igl::SLIMData::EXP_SYMMETRIC_DIRICHLET:
+          return exp(s.exp_factor * (pow(s1, 2) + pow(s1, -2) + pow(s2, 2) + pow(s2, -2) + pow(s3, 2) + pow(s3, -2)));
+        case igl::SLIMData::LOG_ARAP:
+          return pow(log(s1), 2) + pow(log(std::abs(s2)), 2) + pow(log(std::abs(s3)), 2);
+        case igl::SLIMData::CONFORMAL:
+          return (pow(s1, 2) + pow(s2, 2) + pow(s3, 2)) / (3 * pow(s1 * s2 * s3, 2. / 3.));
+        case igl::SLIMData::EXP_CONFORMAL:
+          return exp((pow(s1, 2) + pow(s2, 2) + pow(s3, 2)) / (3 * pow(s1 * s2 * s3, 2. / 3.)));
+      }
+      return 0;
+    }
+
+    // jacobian of tet t at uv from the corner gradients
+    IGL_INLINE Eigen::Matrix3d tet_jacobian(const igl::SLIMData& s, const Eigen::MatrixXd &uv, int t)
+    {
+      Eigen::Matrix3d ji;
+      for (int c = 0; c < 3; c++)
+        for (int b = 0; b < 3; b++)
+        {
+          double v = 0;
+          for (int j = 0; j < 4; j++) v += s.tet_grad(t, 4 * b + j) * uv(s.F(t, j), c);
+          ji(c, b) = v;
+        }
+      return ji;
+    }
+
+    // one term of compute_energy_with_jacobians
+    IGL_INLINE double tet_energy_at(const igl::SLIMData& s, const Eigen::MatrixXd &uv, int t)
+    {
+      Eigen::Matrix3d ji = tet_jacobian(s, uv, t), ri, ti, ui, vi;
+      Eigen::Vector3d sing;
+      igl::polar_svd(ji, ri, ti, ui, sing, vi);
+      return s.M(t) * energy_3d(s, sing(0), sing(1), sing(2));
+    }
+
+    // fills the per tet cache at V_o, returns the tet part of the energy
+    IGL_INLINE double compute_tet_energies(igl::SLIMData& s)
+    {
+      s.tet_energy.resize(s.f_n);
+      igl::parallel_for(s.f_n, [&](const int t) { s.tet_energy(t) = tet_energy_at(s, s.V_o, t); }, s.min_parallel);
+      return s.tet_energy.sum();
+    }
+
+    // flip_avoiding_line_search for tets: parallel max step, and trial energies
+    // re-evaluated only on the tets with a moving corner, the others keep their cached energy
+    IGL_INLINE double line_search_3d(igl::SLIMData& s, Eigen::MatrixXd &dst)
+    {
+      Eigen::MatrixXd d = dst - s.V_o;
+      double max_step = igl::flip_avoiding::compute_max_step_from_singularities(s.V_o, s.F, d, s.min_parallel);
+      double step = std::min(1., max_step * 0.8);
+
+      Eigen::VectorXd d_norm = d.rowwise().norm();
+      double still = 1e-12 * (d_norm.size() ? d_norm.maxCoeff() : 0);
+      std::vector<int> moving;
+      double static_e = 0;
+      for (int t = 0; t < s.f_n; t++)
+      {
+        bool moves = false;
+        for (int j = 0; j < 4; j++) moves = moves || d_norm(s.F(t, j)) > still;
+        if (moves) moving.push_back(t);
+        else static_e += s.tet_energy(t);
+      }
+
+      double old_e = s.energy * s.mesh_area, new_e = old_e;
+      Eigen::VectorXd trial(moving.size());
+      for (int iter = 0; new_e >= old_e && iter < 12; iter++)
+      {
+        Eigen::MatrixXd x = s.V_o + step * d;
+        Eigen::VectorXd partial;
+        igl::parallel_for(moving.size(),
+          [&](const size_t n) { partial.setZero(n); },
+          [&](const int i, const size_t thread) { trial(i) = tet_energy_at(s, x, moving[i]); partial(thread) += trial(i); },
+          [&](const size_t thread) {}, s.min_parallel);
+        double e = static_e + partial.sum() + compute_soft_const_energy(s, s.V, s.F, x);
+        if (e >= old_e) step /= 2;
+        else
+        {
+          s.V_o = x;
+          new_e = e;
+          for (size_t i = 0; i < moving.size(); i++) s.tet_energy(moving[i]) = trial(i);
+        }
+      }
+      return new_e;
+    }
+
+    // V_o holds G(x0), the plain iteration from x0. The extrapolation over the history
+    // replaces it only if it inverts no tet and has lower energy, otherwise the history restarts
+    IGL_INLINE void anderson_step(igl::SLIMData& s, const Eigen::MatrixXd &x0)
+    {
+      SLIMAnderson &a = *s.anderson;
+      int n = 3 * s.v_n;
+      Eigen::Map<const Eigen::VectorXd> x(x0.data(), n), g(s.V_o.data(), n);
+      if (a.F.rows() != s.F.rows() || a.F != s.F || a.x_last.size() != n || (x - a.x_last).norm() > 1e-12 * (1 + x.norm()))
+      {
+        a.reset();
+        a.F = s.F;
+      }
+      Eigen::VectorXd f = g - x;
+      if (a.has_prev)
+      {
+        if (a.dG.rows() != n || a.dG.cols() != a.m) { a.dG.resize(n, a.m); a.dF.resize(n, a.m); }
+        a.dG.col(a.next) = g - a.g_prev;
+        a.dF.col(a.next) = f - a.f_prev;
+        a.next = (a.next + 1) % a.m;
+        a.cols = std::min(a.cols + 1, a.m);
+      }
+      a.g_prev = g; a.f_prev = f; a.has_prev = true;
+      a.x_last = g;
+      if (a.cols == 0) return;
+
+      Eigen::VectorXd gamma = a.dF.leftCols(a.cols).colPivHouseholderQr().solve(f);
+      Eigen::MatrixXd y = s.V_o;
+      Eigen::Map<Eigen::VectorXd>(y.data(), n) -= a.dG.leftCols(a.cols) * gamma;
+
+      Eigen::VectorXd trial(s.f_n);
+      igl::parallel_for(s.f_n, [&](const int t)
+      {
+        bool kept = tet_jacobian(s, y, t).determinant() * tet_jacobian(s, s.V_o, t).determinant() > 0;
+        trial(t) = kept ? tet_energy_at(s, y, t) : std::numeric_limits<double>::infinity();
+      }, s.min_parallel);
+      double e = trial.sum() + compute_soft_const_energy(s, s.V, s.F, y);
+      if (e < s.energy * s.mesh_area)
+      {
+        s.V_o = y;
+        s.tet_energy = trial;
+        s.energy = e / s.mesh_area;
+        a.x_last = Eigen::Map<Eigen::VectorXd>(y.data(), n);
+        a.accepted++;
+      }
+      else
+      {
+        a.restart();
+        a.rejected++;
+      }
+    }
+
     IGL_INLINE void buildA(igl::SLIMData& s, Eigen::SparseMatrix<double> &A)
     {
       // formula (35) in paper
@@ -1022,13 +1500,12 @@ IGL_INLINE void igl::slim_precompute(Eigen::MatrixXd &V, Eigen::MatrixXi &F, Eig
 	Eigen::VectorXi &ids_T_, Eigen::MatrixXd &normal_T_, Eigen::VectorXd &dis_T_, 
 	Eigen::VectorXi &regionb, Eigen::MatrixXd &regionbc,
 	bool surface_projection, bool global_opt,
-	std::vector<Eigen::MatrixXd> RF
+	const Eigen::Matrix<double, Eigen::Dynamic, 12, Eigen::RowMajor> &RF
 )
 {
 
   data.V = V;
   data.F = F;
-  data.RF = RF;
   data.V_o = V_init;
 
   data.v_num = V.rows();
@@ -1069,8 +1546,12 @@ IGL_INLINE void igl::slim_precompute(Eigen::MatrixXd &V, Eigen::MatrixXi &F, Eig
 
   assert (F.cols() == 3 || F.cols() == 4);
 
-  igl::slim::pre_calc(data);
-  data.energy = igl::slim::compute_energy(data,data.V_o) / data.mesh_area;
+  igl::slim::pre_calc(data, RF);
+  if (data.dim == 3)
+    data.energy = (igl::slim::compute_tet_energies(data) +
+                   igl::slim::compute_soft_const_energy(data, data.V, data.F, data.V_o)) / data.mesh_area;
+  else
+    data.energy = igl::slim::compute_energy(data,data.V_o) / data.mesh_area;
 }
 
 
@@ -1080,6 +1561,8 @@ IGL_INLINE Eigen::MatrixXd igl::slim_solve(SLIMData &data, int iter_num)
   {
     Eigen::MatrixXd dest_res;
     dest_res = data.V_o;
+    Eigen::MatrixXd x0;
+    if (data.dim == 3 && data.anderson) x0 = data.V_o;
 
     // Solve Weighted Proxy
 	Timer<> time0, time1, time2;
@@ -1092,16 +1575,21 @@ IGL_INLINE Eigen::MatrixXd igl::slim_solve(SLIMData &data, int iter_num)
 
     double old_energy = data.energy;
 	//time2.beginStage(" flip_avoiding");
-    std::function<double(Eigen::MatrixXd &)> compute_energy = [&](
-        Eigen::MatrixXd &aaa) { return igl::slim::compute_energy(data,aaa); };
+    if (data.dim == 3)
+      data.energy = igl::slim::line_search_3d(data, dest_res) / data.mesh_area;
+    else
+    {
+      std::function<double(Eigen::MatrixXd &)> compute_energy = [&](
+          Eigen::MatrixXd &aaa) { return igl::slim::compute_energy(data,aaa); };
 
-    data.energy = igl::flip_avoiding_line_search(data.F, data.V_o, dest_res, compute_energy,
-                                                 data.energy * data.mesh_area) / data.mesh_area;
+      data.energy = igl::flip_avoiding_line_search(data.F, data.V_o, dest_res, compute_energy,
+                                                   data.energy * data.mesh_area) / data.mesh_area;
+    }
+    if (data.dim == 3 && data.anderson) igl::slim::anderson_step(data, x0);
 	//time2.endStage("end flip_avoiding");
   }
   return data.V_o;
 }
 
 #ifdef IGL_STATIC_LIBRARY
-template void igl::slim_precompute(class Eigen::Matrix<double, -1, -1, 0, -1, -1> &, class Eigen::Matrix<int, -1, -1, 0, -1, -1> &, class Eigen::Matrix<double, -1, -1, 0, -1, -1> &, struct igl::SLIMData &, enum igl::SLIMData::SLIM_ENERGY, class Eigen::Matrix<int, -1, 1, 0, -1, 1> &, class Eigen::Matrix<double, -1, -1, 0, -1, -1> &, class Eigen::Matrix<int, -1, 1, 0, -1, 1> &, class Eigen::Matrix<double, -1, -1, 0, -1, -1> &, class Eigen::Matrix<int, -1, 1, 0, -1, 1> &, class Eigen::Matrix<double, -1, -1, 0, -1, -1> &, class Eigen::Matrix<double, -1, -1, 0, -1, -1> &, class Eigen::Matrix<int, -1, 1, 0, -1, 1> &, class Eigen::Matrix<double, -1, -1, 0, -1, -1> &, class Eigen::Matrix<double, -1, 1, 0, -1, 1> &, class Eigen::Matrix<int, -1, 1, 0, -1, 1> &, class Eigen::Matrix<double, -1, -1, 0, -1, -1> &, bool, bool, class std::vector<class Eigen::Matrix<double, -1, -1, 0, -1, -1>, class std::allocator<class Eigen::Matrix<double, -1, -1, 0, -1, -1> > >);
 #endif
\ No newline at end of file
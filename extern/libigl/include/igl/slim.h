@@ -11,17 +11,54 @@
 #include "igl_inline.h"
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
+#include <memory>
+#include <vector>
 
 namespace igl
 {
 
+// Fixed sparsity pattern of the 3D system matrix, built once per tet set and
+// filled in place on every iteration. Column c*v_n+u holds the rows c'*v_n+w,
+// w in the sorted one-ring of u, block by block, then the feature line
+// auxiliary rows, then the mean variable of each coincidence group holding u.
+struct SLIMPattern
+{
+  // what the pattern was built for
+  Eigen::MatrixXi F;
+  int v_n = 0, aux_n = 0;
+  std::vector<std::vector<uint32_t>> Vgroups;
+  int n = 0; // 3 * v_n + aux_n + 3 * Vgroups.size()
+
+  bool assembled = true; // false: only the incidences, for the matrix-free solve
+  Eigen::SparseMatrix<double> L;
+  Eigen::VectorXi deg, diag_pos; // per vertex: one-ring size, own position in it
+  Eigen::VectorXi vt_start, vt; // vertex -> 4 * tet + corner
+  Eigen::Matrix<int, Eigen::Dynamic, 16, Eigen::RowMajor> tet_pos; // position of F(t,j) in the one-ring of F(t,k), at 4*j+k
+};
+
+// Anderson acceleration of the 3D local-global iterations, type II with a window
+// of m steps. The history carries over to the next solve on the same tet set
+// that starts where the last one stopped, and restarts otherwise.
+struct SLIMAnderson
+{
+  int m = 5;
+  Eigen::MatrixXi F;
+  Eigen::VectorXd x_last; // where the last solve stopped
+  Eigen::MatrixXd dG, dF; // differences of the plain iterates G(x) and of the residuals G(x) - x
+  Eigen::VectorXd g_prev, f_prev;
+  int cols = 0, next = 0;
+  bool has_prev = false;
+  int accepted = 0, rejected = 0;
+  void restart() { cols = next = 0; }
+  void reset() { restart(); has_prev = false; x_last.resize(0); }
+};
+
 // Compute a SLIM map as derived in "Scalable Locally Injective Maps" [Rabinovich et al. 2016].
 struct SLIMData
 {
   // Input
   Eigen::MatrixXd V; // #V by 3 list of mesh vertex positions
   Eigen::MatrixXi F; // #F by 3/3 list of mesh faces (triangles/tets)
-  std::vector<Eigen::MatrixXd> RF;
   enum SLIM_ENERGY
   {
     ARAP,
@@ -92,6 +129,17 @@ struct SLIMData
   bool first_solve;
   bool has_pre_calc = false;
   int dim;
+  // 3D: may be shared across solves on the same tet set, rebuilt on mismatch
+  std::shared_ptr<SLIMPattern> pattern;
+  // 3D: apply L tet by tet inside CG instead of assembling it
+  bool matrix_free = false;
+  // 3D: x,y,z gradient of the 4 corners of each tet (rows of Dx, Dy, Dz), and its energy at V_o
+  Eigen::Matrix<double, Eigen::Dynamic, 12, Eigen::RowMajor> tet_grad;
+  Eigen::VectorXd tet_energy;
+  // element loops shorter than this run serially; raise it when solving many regions concurrently
+  size_t min_parallel = 1000;
+  // 3D: extrapolate each iteration over the previous ones, null: plain iterations
+  std::shared_ptr<SLIMAnderson> anderson;
 };
 
 // Compute necessary information to start using SLIM
@@ -102,6 +150,7 @@ struct SLIMData
 //    bc          #b by dim list of boundary conditions
 //    soft_p      Soft penalty factor (can be zero)
 //    slim_energy Energy to minimize
+//    RF          #F by 12 reference shape of each tet, 4 corners packed xyz
 IGL_INLINE void slim_precompute(Eigen::MatrixXd& V,
                                 Eigen::MatrixXi& F,
                                 Eigen::MatrixXd& V_init,
@@ -114,7 +163,7 @@ IGL_INLINE void slim_precompute(Eigen::MatrixXd& V,
 	Eigen::VectorXi &ids_T_, Eigen::MatrixXd &normal_T_, Eigen::VectorXd &dis_T_, 
 	Eigen::VectorXi &regionb, Eigen::MatrixXd &regionbc,
 	bool surface_projection, bool global_opt,
-	std::vector<Eigen::MatrixXd> RF
+	const Eigen::Matrix<double, Eigen::Dynamic, 12, Eigen::RowMajor> &RF
 	);
 
 // Run iter_num iterations of SLIM
@@ -13,6 +13,15 @@
 #include "global_functions.h"
 #include "global_types.h"
 #include "igl/bounding_box_diagonal.h"
+#include <cstring>
+#include <atomic>
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 //===================================mesh connectivities===================================
 void build_connectivity(Mesh &hmi) {
 	hmi.Es.clear(); if (hmi.Hs.size()) hmi.Fs.clear();
@@ -211,6 +220,84 @@ void build_connectivity(Mesh &hmi) {
 		std::sort(nhs.begin(), nhs.end()); nhs.erase(std::unique(nhs.begin(), nhs.end()), nhs.end());
 		hmi.Es[i].neighbor_hs = nhs;
 	}
+	build_vs_index(hmi.Es, hmi.Fs, hmi.E_index, hmi.F_index);
+}
+Vs_Key vs_key(uint32_t v0, uint32_t v1) {
+	if (v0 > v1) std::swap(v0, v1);
+	Vs_Key key = { { v0, v1, (uint32_t)-1, (uint32_t)-1 } };
+	return key;
+}
+Vs_Key vs_key(const vector<uint32_t> &vs) {
+	Vs_Key key; key.fill((uint32_t)-1);
+	std::copy(vs.begin(), vs.begin() + std::min<size_t>(vs.size(), 4), key.begin());
+	std::sort(key.begin(), key.end());
+	return key;
+}
+uint32_t vs_lookup(const Vs_Index &index, const Vs_Key &key) {
+	auto it = index.find(key);
+	if (it == index.end()) return (uint32_t)-1;
+	return it->second;
+}
+static inline uint64_t hash_mix(uint64_t h) {
+	h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+	return h ^ (h >> 33);
+}
+uint64_t geometry_hash(const Mesh &mesh, const vector<uint32_t> &hs) {
+	uint64_t sum = hs.size();
+	for (auto hid : hs) {
+		uint64_t hh = 0;
+		for (auto vid : mesh.Hs[hid].vs) {
+			uint64_t hv = mesh.Vs[vid].neighbor_hs.size();
+			for (uint32_t j = 0; j < 3; j++) {
+				Float x = mesh.V(j, vid);
+				uint64_t bits = 0;
+				memcpy(&bits, &x, sizeof(Float));
+				hv = hash_mix(hv ^ bits);
+			}
+			hh += hash_mix(hv);
+		}
+		sum += hash_mix(hh);
+	}
+	return sum;
+}
+uint64_t ordered_geometry_hash(const Mesh &mesh, const vector<uint32_t> &hs) {
+	uint64_t h = hs.size();
+	for (auto hid : hs) for (auto vid : mesh.Hs[hid].vs) for (uint32_t j = 0; j < 3; j++) {
+		Float x = mesh.V(j, vid);
+		uint64_t bits = 0;
+		memcpy(&bits, &x, sizeof(Float));
+		h = hash_mix(h ^ bits);
+	}
+	return h;
+}
+uint32_t quad_opposite_e(const vector<uint32_t> &es, uint32_t eid) {
+	for (uint32_t k = 0; k < 4; k++) if (es[k] == eid) return es[(k + 2) % 4];
+	return (uint32_t)-1;
+}
+uint32_t cuboid_opposite_f(const Frame_H &h, uint32_t fid) {
+	for (uint32_t k = 0; k < h.fs.size() && k < 6; k++) if (h.fs[k] == fid) return h.fs_op[k] < 0 ? (uint32_t)-1 : h.fs[h.fs_op[k]];
+	return (uint32_t)-1;
+}
+//edge ring: pre_e and e are consecutive edges of a chain and pre_f a quad on pre_e,
+//returns the quad on e that shares the rung edge at their common vertex with pre_f
+uint32_t strip_next_f(const Mesh &mesh, uint32_t pre_f, uint32_t pre_e, uint32_t e) {
+	const vector<uint32_t> &pes = mesh.Fs[pre_f].es, &pvs = mesh.Es[pre_e].vs, &evs = mesh.Es[e].vs;
+	uint32_t v = (pvs[0] == evs[0] || pvs[0] == evs[1]) ? pvs[0] : pvs[1];
+	uint32_t rung = (uint32_t)-1;
+	for (uint32_t k = 0; k < 4; k++) if (pes[k] == pre_e) {
+		for (int d = 1; d < 4; d += 2) {
+			uint32_t r = pes[(k + d) % 4];
+			if (mesh.Es[r].vs[0] == v || mesh.Es[r].vs[1] == v) { rung = r; break; }
+		}
+		break;
+	}
+	if (rung == (uint32_t)-1) return rung;
+	for (auto nfid : mesh.Es[e].neighbor_fs) {
+		const vector<uint32_t> &nes = mesh.Fs[nfid].es;
+		if (nfid != pre_f && std::find(nes.begin(), nes.end(), rung) != nes.end()) return nfid;
+	}
+	return (uint32_t)-1;
 }
 void topology_info(Mesh &mesh, Frame &frame, Mesh_Topology & mt) {
 
@@ -468,7 +555,7 @@ double average_edge_length(Mesh &mesh) {
 	double ave_length = 0;
 	for (uint32_t i = 0; i < mesh.Fs.size(); i++) {
 		auto &vs = mesh.Fs[i].vs;
-		for (uint32_t j = 0; j < 3; j++) ave_length += (mesh.V.col(vs[j]) - mesh.V.col(vs[(j + 1) % 3])).norm();
+		for (uint32_t j = 0; j < 3; j++) ave_length += (mesh.V.col(vs[j]).cast<double>() - mesh.V.col(vs[(j + 1) % 3]).cast<double>()).norm();
 	}
 	int N = mesh.Fs.size() * 3;
 	ave_length /= N;
@@ -572,10 +659,10 @@ void  orient_surface_mesh(Mesh &hmi) {
 	Vector3d ori; ori.setZero();
 	for (auto f : hmi.Fs) {
 		auto &fvs = f.vs;
-		Vector3d center; center.setZero(); for (auto vid : fvs) center += hmi.V.col(vid); center /= fvs.size();
+		Vector3d center; center.setZero(); for (auto vid : fvs) center += hmi.V.col(vid).cast<double>(); center /= fvs.size();
 
 		for (uint32_t j = 0; j < fvs.size(); j++) {
-			Vector3d x = hmi.V.col(fvs[j]) - ori, y = hmi.V.col(fvs[(j + 1) % fvs.size()]) - ori, z = center - ori;
+			Vector3d x = hmi.V.col(fvs[j]).cast<double>() - ori, y = hmi.V.col(fvs[(j + 1) % fvs.size()]).cast<double>() - ori, z = center - ori;
 			res += -((x[0] * y[1] * z[2] + x[1] * y[2] * z[0] + x[2] * y[0] * z[1]) - (x[2] * y[1] * z[0] + x[1] * y[0] * z[2] + x[0] * y[2] * z[1]));
 		}
 	}
@@ -1177,10 +1264,10 @@ bool scaled_jacobian(Mesh &hmi, Mesh_Quality &mq)
 			v0 = hex_tetra_table[j][0]; v1 = hex_tetra_table[j][1];
 			v2 = hex_tetra_table[j][2]; v3 = hex_tetra_table[j][3];
 
-			Vector3d c0 = hmi.V.col(hmi.Hs[i].vs[v0]);
-			Vector3d c1 = hmi.V.col(hmi.Hs[i].vs[v1]);
-			Vector3d c2 = hmi.V.col(hmi.Hs[i].vs[v2]);
-			Vector3d c3 = hmi.V.col(hmi.Hs[i].vs[v3]);
+			Vector3d c0 = hmi.V.col(hmi.Hs[i].vs[v0]).cast<double>();
+			Vector3d c1 = hmi.V.col(hmi.Hs[i].vs[v1]).cast<double>();
+			Vector3d c2 = hmi.V.col(hmi.Hs[i].vs[v2]).cast<double>();
+			Vector3d c3 = hmi.V.col(hmi.Hs[i].vs[v3]).cast<double>();
 
 			double jacobian_value = a_jacobian(c0, c1, c2, c3);
 
@@ -1221,6 +1308,19 @@ double a_jacobian(Vector3d &v0, Vector3d &v1, Vector3d &v2, Vector3d &v3)
 	scaled_jacobian /= norm1*norm2*norm3;
 	return scaled_jacobian;
 }
+double hex_scaled_jacobian(const Vector3d cs[8]) {
+	double minJ = 1;
+	for (uint32_t j = 0; j < 8; j++) {
+		Matrix3d Jacobian;
+		Jacobian.col(0) = cs[hex_tetra_table[j][1]] - cs[hex_tetra_table[j][0]];
+		Jacobian.col(1) = cs[hex_tetra_table[j][2]] - cs[hex_tetra_table[j][0]];
+		Jacobian.col(2) = cs[hex_tetra_table[j][3]] - cs[hex_tetra_table[j][0]];
+		double norm = Jacobian.col(0).norm() * Jacobian.col(1).norm() * Jacobian.col(2).norm();
+		if (norm < Precision * Precision * Precision) return -1;
+		minJ = std::min(minJ, Jacobian.determinant() / norm);
+	}
+	return minJ;
+}
 //===================================feature v tags==========================================
 bool triangle_mesh_feature(Mesh_Feature &mf, Mesh &hmi){
 
@@ -1276,10 +1376,10 @@ bool triangle_mesh_feature(Mesh_Feature &mf, Mesh &hmi){
 	mf.Tcenters.clear(); mf.Tcenters.resize(mesh.Fs.size());
 	for (uint32_t i = 0; i < mesh.Fs.size(); i++) {
 		const auto &vs = mesh.Fs[i].vs;
-		Vector3d vec0 = mesh.V.col(vs[1]) - mesh.V.col(vs[0]);
-		Vector3d vec1 = mesh.V.col(vs[2]) - mesh.V.col(vs[0]);
+		Vector3d vec0 = mesh.V.col(vs[1]).cast<double>() - mesh.V.col(vs[0]).cast<double>();
+		Vector3d vec1 = mesh.V.col(vs[2]).cast<double>() - mesh.V.col(vs[0]).cast<double>();
 
-		mf.normal_Tri.col(i) = (vec0.cross(vec1)).normalized();
+		mf.normal_Tri.col(i) = (vec0.cross(vec1)).normalized().cast<Float>();
 		mf.normal_V.col(vs[0]) += mf.normal_Tri.col(i);
 		mf.normal_V.col(vs[1]) += mf.normal_Tri.col(i);
 		mf.normal_V.col(vs[2]) += mf.normal_Tri.col(i);
@@ -1291,13 +1391,13 @@ bool triangle_mesh_feature(Mesh_Feature &mf, Mesh &hmi){
 		mf.Tcenters[i] /= 3;
 	}
 	for (uint32_t i = 0; i<mf.normal_V.cols(); ++i) 
-		if (mf.normal_V.col(i) != Vector3d::Zero()) mf.normal_V.col(i) = mf.normal_V.col(i).normalized();
+		if (mf.normal_V.col(i) != Vector3F::Zero()) mf.normal_V.col(i) = mf.normal_V.col(i).normalized();
 	mf.ave_length = 0;
 	for (uint32_t i = 0; i < mesh.Es.size(); i++) {
 			uint32_t v0 = mesh.Es[i].vs[0];
 			uint32_t v1 = mesh.Es[i].vs[1];
 
-			mf.ave_length += (mesh.V.col(v0) - mesh.V.col(v1)).norm();
+			mf.ave_length += (mesh.V.col(v0).cast<double>() - mesh.V.col(v1).cast<double>()).norm();
 	}
 	mf.ave_length /= mesh.Es.size();
 //feature edges, vs
@@ -1305,8 +1405,8 @@ bool triangle_mesh_feature(Mesh_Feature &mf, Mesh &hmi){
 	mf.v_types.resize(mesh.Vs.size()); fill(mf.v_types.begin(), mf.v_types.end(), 0);
 	vector<Float> Dihedral_angles(mesh.Es.size());
 	for (uint32_t i = 0; i < mesh.Es.size(); i++) {
-		Vector3d n0 = mf.normal_Tri.col(mesh.Es[i].neighbor_fs[0]);
-		Vector3d n1 = mf.normal_Tri.col(mesh.Es[i].neighbor_fs[1]);
+		Vector3d n0 = mf.normal_Tri.col(mesh.Es[i].neighbor_fs[0]).cast<double>();
+		Vector3d n1 = mf.normal_Tri.col(mesh.Es[i].neighbor_fs[1]).cast<double>();
 
 		Dihedral_angles[i] = PAI - acos(n0.dot(n1));
 
@@ -1333,7 +1433,7 @@ bool triangle_mesh_feature(Mesh_Feature &mf, Mesh &hmi){
 			for (auto eid : mesh.Vs[i].neighbor_es) if (E_feature_flag[eid]) {
 				uint32_t v0 = mesh.Es[eid].vs[0]; vs.push_back(v0);
 				uint32_t v1 = mesh.Es[eid].vs[1]; vs.push_back(v1);
-				ns.push_back((mesh.V.col(v0) - mesh.V.col(v1)).normalized());
+				ns.push_back((mesh.V.col(v0).cast<double>() - mesh.V.col(v1).cast<double>()).normalized());
 			}
 
 			if (vs[0] == vs[2] || vs[1] == vs[3]) ns[0] *= -1;
@@ -1451,11 +1551,11 @@ bool initial_feature(Mesh_Feature &mf, Feature_Constraints &fc, Mesh &hmi) {
 	for (uint32_t i = 0; i < hmi.Vs.size(); i++) {
 		if (fc.V_types[i] == Feature_V_Type::CORNER) {
 			fc.ids_C[num_corners] = i;
-			fc.C.row(num_corners++) = mf.tri.V.col(fc.V_ids[i]);
+			fc.C.row(num_corners++) = mf.tri.V.col(fc.V_ids[i]).cast<double>();
 		}
 		else if (fc.V_types[i] == Feature_V_Type::LINE) {
 			fc.ids_L[num_lines] = i;
-			fc.origin_L.row(num_lines) = hmi.V.col(i);
+			fc.origin_L.row(num_lines) = hmi.V.col(i).cast<double>();
 			uint32_t curve_id = fc.V_ids[i];
 			vector<uint32_t> &curve = mf.curve_vs[curve_id];
 			if (find(curve.begin(), curve.end(), mf.V_map[i]) == curve.end()) {
@@ -1466,16 +1566,16 @@ bool initial_feature(Mesh_Feature &mf, Feature_Constraints &fc, Mesh &hmi) {
 			uint32_t curve_len = curve.size();
 			if (mf.circles[curve_id] || (!mf.circles[curve_id] && pos !=0 && pos != curve_len - 1)) {
 				int32_t pos_0 = (pos -1 + curve_len) % curve_len, pos_1 = (pos + 1) % curve_len;
-				tangent += (mf.tri.V.col(curve[pos]) - mf.tri.V.col(curve[pos_0])).normalized();
-				tangent += (mf.tri.V.col(curve[pos_1]) - mf.tri.V.col(curve[pos])).normalized();
+				tangent += (mf.tri.V.col(curve[pos]).cast<double>() - mf.tri.V.col(curve[pos_0]).cast<double>()).normalized();
+				tangent += (mf.tri.V.col(curve[pos_1]).cast<double>() - mf.tri.V.col(curve[pos]).cast<double>()).normalized();
 			}
 			else if (!mf.circles[curve_id] && pos == 0) {
 				int32_t pos_1 = (pos + 1) % curve_len;
-				tangent += (mf.tri.V.col(curve[pos_1]) - mf.tri.V.col(curve[pos])).normalized();
+				tangent += (mf.tri.V.col(curve[pos_1]).cast<double>() - mf.tri.V.col(curve[pos]).cast<double>()).normalized();
 			}
 			else if (!mf.circles[curve_id] && pos == curve_len - 1) {
 				int32_t pos_0 = (pos - 1 + curve_len) % curve_len;
-				tangent += (mf.tri.V.col(curve[pos]) - mf.tri.V.col(curve[pos_0])).normalized();
+				tangent += (mf.tri.V.col(curve[pos]).cast<double>() - mf.tri.V.col(curve[pos_0]).cast<double>()).normalized();
 			}
 			if(tangent == Vector3d::Zero()){ 
 				cout << "ERROR in curve" << endl; system("PAUSE"); 
@@ -1486,9 +1586,9 @@ bool initial_feature(Mesh_Feature &mf, Feature_Constraints &fc, Mesh &hmi) {
 		else if (fc.V_types[i] == Feature_V_Type::REGULAR) {
 			fc.ids_T[num_regulars] = i;
 			uint32_t vid = fc.V_ids[i];
-			fc.normal_T.row(num_regulars) = mf.normal_V.col(vid);
-			fc.V_T.row(num_regulars) = mf.tri.V.col(vid); 
-			fc.dis_T[num_regulars++] = mf.normal_V.col(vid).dot(mf.tri.V.col(vid));
+			fc.normal_T.row(num_regulars) = mf.normal_V.col(vid).cast<double>();
+			fc.V_T.row(num_regulars) = mf.tri.V.col(vid).cast<double>(); 
+			fc.dis_T[num_regulars++] = mf.normal_V.col(vid).cast<double>().dot(mf.tri.V.col(vid).cast<double>());
 		}
 	}
 
@@ -1513,10 +1613,10 @@ bool project_surface_update_feature(Mesh_Feature &mf, Feature_Constraints &fc, M
 			CI.push_back(std::make_tuple(Feature_V_Type::REGULAR, i, num_regulars++, bc_num++));
 	}
 
-	GRAIN_SIZE = 10;
 #if 0
+	const int32_t grain_size = 10;
 	tbb::parallel_for(
-		tbb::blocked_range<uint32_t>(0u, (uint32_t)CI.size(), GRAIN_SIZE),
+		tbb::blocked_range<uint32_t>(0u, (uint32_t)CI.size(), grain_size),
 		[&](const tbb::blocked_range<uint32_t> &range) {
 		for (uint32_t m = range.begin(); m != range.end(); m++) {
 #endif
@@ -1529,7 +1629,7 @@ bool project_surface_update_feature(Mesh_Feature &mf, Feature_Constraints &fc, M
 			Vector3d pv, v;
 
 			if (type == Feature_V_Type::CORNER) {
-				pv = mf.tri.V.col(fc.V_ids[i]);
+				pv = mf.tri.V.col(fc.V_ids[i]).cast<double>();
 				fc.C.row(mi) = pv;
 			}
 			else if (type == Feature_V_Type::LINE) {
@@ -1548,9 +1648,9 @@ bool project_surface_update_feature(Mesh_Feature &mf, Feature_Constraints &fc, M
 				for (uint32_t j = 0; j < curve_len; j++) {
 					uint32_t pos_0 = curve[j], pos_1 = curve[(j + 1) % curve.size()];
 					double t, precision_here = 1.0e1;
-					point_line_projection(mf.tri.V.col(pos_0), mf.tri.V.col(pos_1), v, pv, t);
+					point_line_projection(mf.tri.V.col(pos_0).cast<double>(), mf.tri.V.col(pos_1).cast<double>(), v, pv, t);
 					{
-						tangent = (mf.tri.V.col(pos_1) - mf.tri.V.col(pos_0)).normalized();
+						tangent = (mf.tri.V.col(pos_1).cast<double>() - mf.tri.V.col(pos_0).cast<double>()).normalized();
 
 						dis_ids.push_back(make_pair((v - pv).norm(), pvs.size()));
 						pvs.push_back(pv);
@@ -1567,27 +1667,27 @@ bool project_surface_update_feature(Mesh_Feature &mf, Feature_Constraints &fc, M
 				}
 				else {
 					for (uint32_t j = 0; j < curve.size(); j++) {
-						double dis = (mf.tri.V.col(curve[j]) - v).norm();
+						double dis = (mf.tri.V.col(curve[j]).cast<double>() - v).norm();
 						dis_ids.push_back(make_pair(dis, j));
 					}
 					sort(dis_ids.begin(), dis_ids.end());
 
 					int pos = dis_ids[0].second;
-					pv = mf.tri.V.col(curve[pos]);
+					pv = mf.tri.V.col(curve[pos]).cast<double>();
 
 					curve_len = curve.size();
 					if (mf.circles[curve_id] || (!mf.circles[curve_id] && pos != 0 && pos != curve_len - 1)) {
 						uint32_t pos_0 = (pos - 1 + curve_len) % curve_len, pos_1 = (pos + 1) % curve_len;
-						tangent += (mf.tri.V.col(curve[pos]) - mf.tri.V.col(curve[pos_0])).normalized();
-						tangent += (mf.tri.V.col(curve[pos_1]) - mf.tri.V.col(curve[pos])).normalized();
+						tangent += (mf.tri.V.col(curve[pos]).cast<double>() - mf.tri.V.col(curve[pos_0]).cast<double>()).normalized();
+						tangent += (mf.tri.V.col(curve[pos_1]).cast<double>() - mf.tri.V.col(curve[pos]).cast<double>()).normalized();
 					}
 					else if (!mf.circles[curve_id] && pos == 0) {
 						uint32_t pos_1 = (pos + 1) % curve_len;
-						tangent += (mf.tri.V.col(curve[pos_1]) - mf.tri.V.col(curve[pos])).normalized();
+						tangent += (mf.tri.V.col(curve[pos_1]).cast<double>() - mf.tri.V.col(curve[pos]).cast<double>()).normalized();
 					}
 					else if (!mf.circles[curve_id] && pos == curve_len - 1) {
 						uint32_t pos_0 = (pos - 1 + curve_len) % curve_len;
-						tangent += (mf.tri.V.col(curve[pos]) - mf.tri.V.col(curve[pos_0])).normalized();
+						tangent += (mf.tri.V.col(curve[pos]).cast<double>() - mf.tri.V.col(curve[pos_0]).cast<double>()).normalized();
 					}
 					tangent.normalize();
 				}
@@ -1607,25 +1707,25 @@ bool project_surface_update_feature(Mesh_Feature &mf, Feature_Constraints &fc, M
 				else tids.push_back(tid);
 
 				Vector3d PreinterpolP = fc.V_T.row(mi), PreinterpolN = fc.normal_T.row(mi);
-				bool found = phong_projection(tids, Loop, tid, v, interpolP, interpolN, PreinterpolP, PreinterpolN);
+				bool found = phong_projection(mf, tids, Loop, tid, v, interpolP, interpolN, PreinterpolP, PreinterpolN);
 				
 				if(!found || (v - interpolP).norm() >= mf.ave_length){
 					tid = 0;
-					double min_dis = (v - mf.Tcenters[0]).norm();
+					double min_dis = (v - mf.Tcenters[0].cast<double>()).norm();
 					for (uint32_t j = 1; j < mf.Tcenters.size(); j++) {
-						if (min_dis > (v - mf.Tcenters[j]).norm()) {
+						if (min_dis > (v - mf.Tcenters[j].cast<double>()).norm()) {
 							tid = j;
-							min_dis = (v - mf.Tcenters[j]).norm();
+							min_dis = (v - mf.Tcenters[j].cast<double>()).norm();
 						}
 					}
 					uint32_t tid_temp = tid;
 					tids.clear();
 					tids.push_back(tid_temp);
-					if (phong_projection(tids, Loop, tid_temp, v, interpolP, interpolN, PreinterpolP, PreinterpolN))
+					if (phong_projection(mf, tids, Loop, tid_temp, v, interpolP, interpolN, PreinterpolP, PreinterpolN))
 						tid = tid_temp;
 					else{
-							interpolP = mf.Tcenters[tid_temp];
-							interpolN = mf.normal_Tri.col(tid_temp);
+							interpolP = mf.Tcenters[tid_temp].cast<double>();
+							interpolN = mf.normal_Tri.col(tid_temp).cast<double>();
 					}
 				}
 				pv = interpolP;
@@ -1645,7 +1745,7 @@ bool project_surface_update_feature(Mesh_Feature &mf, Feature_Constraints &fc, M
 #endif
 	return true;
 }
-bool phong_projection(vector<uint32_t> &tids, uint32_t Loop, uint32_t &tid, Vector3d &v, Vector3d &interpolP, Vector3d &interpolN, Vector3d &PreinterpolP, Vector3d &PreinterpolN) {
+bool phong_projection(Mesh_Feature &mf, vector<uint32_t> &tids, uint32_t Loop, uint32_t &tid, Vector3d &v, Vector3d &interpolP, Vector3d &interpolN, Vector3d &PreinterpolP, Vector3d &PreinterpolN) {
 	vector<bool> t_flag(mf.tri.Fs.size(), false);
 
 	vector<uint32_t> tids_;
@@ -1674,8 +1774,8 @@ bool phong_projection(vector<uint32_t> &tids, uint32_t Loop, uint32_t &tid, Vect
 			vector<Vector3d> tri_vs(3), vs_normals(3);
 			vector<uint32_t> &vs = mf.tri.Fs[ts[j]].vs;
 			for (uint32_t k = 0; k < 3; k++) {
-				tri_vs[k] = mf.tri.V.col(vs[k]);
-				vs_normals[k] = mf.normal_V.col(vs[k]);
+				tri_vs[k] = mf.tri.V.col(vs[k]).cast<double>();
+				vs_normals[k] = mf.normal_V.col(vs[k]).cast<double>();
 			}
 			Vector2d uv;
 			projectPointOnTriangle(tri_vs, vs_normals, v, uv, interpolP, interpolN);
@@ -1818,12 +1918,12 @@ Float rescale(Mesh &mesh, Float scaleI, bool inverse = false) {
 	if (!inverse) {
 		RowVector3d c; c.setZero();
 		for (uint32_t i = 0; i < mesh.V.cols(); i++)
-			c += mesh.V.col(i);
+			c += mesh.V.col(i).cast<double>();
 		c /= mesh.V.cols();
 		for (uint32_t i = 0; i < mesh.V.cols(); i++)
-			mesh.V.col(i) -= c;
-		Vector3d min_ = mesh.V.rowwise().minCoeff();
-		Vector3d max_ = mesh.V.rowwise().maxCoeff();
+			mesh.V.col(i) -= c.cast<Float>();
+		Vector3d min_ = mesh.V.rowwise().minCoeff().cast<double>();
+		Vector3d max_ = mesh.V.rowwise().maxCoeff().cast<double>();
 
 		double diagonal_local = (max_ - min_).norm();
 		double scale = 5.0 / diagonal_local;
@@ -1835,16 +1935,43 @@ Float rescale(Mesh &mesh, Float scaleI, bool inverse = false) {
 	}
 	return 1.0;
 }
-void compute_referenceMesh(MatrixXd &V, vector<Hybrid> &H, vector<uint32_t> &Hs, vector<MatrixXd> &Vout) {
-	vector<MatrixXd>().swap(Vout);
-
-	for (auto hid : Hs) {
-		vector<MatrixXd> vout;
-		hex2cuboid(V, H[hid].vs, vout);
-		Vout.insert(Vout.end(),vout.begin(), vout.end());
-	}
+void compute_referenceMesh(const MatrixXd &V, const vector<Hybrid> &H, const vector<uint32_t> &Hs, Tet_Shapes &Vout) {
+	Vout.resize(8 * Hs.size(), 12);
+	for (uint32_t i = 0; i < Hs.size(); i++)
+		hex2cuboid(V, H[Hs[i]].vs, Vout, 8 * i);
+}
+void compute_referenceMesh(const MatrixXd &V, const vector<Hybrid> &H, const vector<uint32_t> &Hs, Tet_Shapes &Vout, Reference_Cache &cache, double tolerance) {
+	//a hex keeps its cuboid while its corners are the same vertices, each within tolerance * its edge length
+	if ((size_t)Vout.rows() != 8 * Hs.size() || cache.vs.size() != 8 * Hs.size()) {
+		Vout.resize(8 * Hs.size(), 12);
+		cache.vs.assign(8 * Hs.size(), (uint32_t)-1);
+		cache.corners.resize(Hs.size(), 24);
+		cache.scale.setZero(Hs.size());
+	}
+	std::atomic<uint32_t> refreshed(0);
+	tbb::parallel_for(
+		tbb::blocked_range<uint32_t>(0u, (uint32_t)Hs.size(), 64),
+		[&](const tbb::blocked_range<uint32_t> &range) {
+		for (uint32_t i = range.begin(); i != range.end(); i++) {
+			const vector<uint32_t> &vs = H[Hs[i]].vs;
+			double limit = tolerance * cache.scale[i];
+			bool fresh = true;
+			for (uint32_t j = 0; j < 8 && fresh; j++)
+				fresh = cache.vs[8 * i + j] == vs[j] && (V.row(vs[j]) - cache.corners.block<1, 3>(i, 3 * j)).squaredNorm() <= limit * limit;
+			if (fresh) continue;
+
+			cache.scale[i] = hex2cuboid(V, vs, Vout, 8 * i);
+			for (uint32_t j = 0; j < 8; j++) {
+				cache.vs[8 * i + j] = vs[j];
+				cache.corners.block<1, 3>(i, 3 * j) = V.row(vs[j]);
+			}
+			refreshed++;
+		}
+	});
+	cache.refreshed += refreshed;
+	cache.reused += Hs.size() - refreshed;
 }
-void hex2cuboid(MatrixXd &V, vector<uint32_t> &vs, vector<MatrixXd> &vout) {
+double hex2cuboid(const MatrixXd &V, const vector<uint32_t> &vs, Tet_Shapes &vout, const uint32_t row) {
 	double volume = 0;
 	hex2tet24(V, vs, volume);
 
@@ -1871,26 +1998,25 @@ void hex2cuboid(MatrixXd &V, vector<uint32_t> &vs, vector<MatrixXd> &vout) {
 	e2 *= ratio;
 
 	//eight vertices
-	MatrixXd v8(8, 3);
-	v8 << 0, 0, 0,
-		e0, 0, 0,
-		e0, e1, 0,
-		0, e1, 0,
-		0, 0, e2,
-		e0, 0, e2,
-		e0, e1, e2,
-		0, e1, e2;
-	//eight tets
-	for (uint32_t i = 0; i < 8; i++) {
-		MatrixXd tet(4, 3);
+	const double v8[8][3] = {
+		{ 0, 0, 0 },
+		{ e0, 0, 0 },
+		{ e0, e1, 0 },
+		{ 0, e1, 0 },
+		{ 0, 0, e2 },
+		{ e0, 0, e2 },
+		{ e0, e1, e2 },
+		{ 0, e1, e2 } };
+	//eight tets, written in place
+	for (uint32_t i = 0; i < 8; i++)
 		for (uint32_t j = 0; j < 4; j++)
-			tet.row(j) = v8.row(hex_tetra_table[i][j]);
-		vout.push_back(tet);
-	}
+			for (uint32_t k = 0; k < 3; k++)
+				vout(row + i, 3 * j + k) = v8[hex_tetra_table[i][j]][k];
+	return (e0 + e1 + e2) / 3;
 }
-void hex2tet24(MatrixXd &V, vector<uint32_t> &vs, double & volume) {
+void hex2tet24(const MatrixXd &V, const vector<uint32_t> &vs, double & volume) {
 	//6 face center
-	vector<RowVector3d> fvs(6);
+	RowVector3d fvs[6];
 	for (int i = 0; i < 6; i++) {
 		fvs[i].setZero();
 		for (int j = 0; j < 4; j++) {
@@ -1917,3 +2043,76 @@ void hex2tet24(MatrixXd &V, vector<uint32_t> &vs, double & volume) {
 		}
 
 }
+//===================================memory==========================================
+template <typename T> size_t vector_bytes(const vector<T> &v) { return v.capacity() * sizeof(T); }
+//node payload plus next pointer, and the bucket array
+size_t index_bytes(const Vs_Index &index) { return index.size() * (sizeof(Vs_Index::value_type) + sizeof(void*)) + index.bucket_count() * sizeof(void*); }
+size_t mesh_bytes(const Mesh &mesh) {
+	size_t bytes = mesh.V.size() * sizeof(Float);
+	bytes += vector_bytes(mesh.Vs) + vector_bytes(mesh.Es) + vector_bytes(mesh.Fs) + vector_bytes(mesh.Hs);
+	for (auto &v : mesh.Vs) bytes += vector_bytes(v.v) + vector_bytes(v.neighbor_vs) + vector_bytes(v.neighbor_es) + vector_bytes(v.neighbor_fs) + vector_bytes(v.neighbor_hs);
+	for (auto &e : mesh.Es) bytes += vector_bytes(e.vs) + vector_bytes(e.neighbor_fs) + vector_bytes(e.neighbor_hs);
+	for (auto &f : mesh.Fs) bytes += vector_bytes(f.vs) + vector_bytes(f.es) + vector_bytes(f.neighbor_hs);
+	for (auto &h : mesh.Hs) bytes += vector_bytes(h.vs) + vector_bytes(h.es) + vector_bytes(h.fs);
+	bytes += index_bytes(mesh.E_index) + index_bytes(mesh.F_index);
+	return bytes;
+}
+size_t singularity_bytes(const Singularity &si) {
+	size_t bytes = vector_bytes(si.SVs) + vector_bytes(si.SEs);
+	for (auto &v : si.SVs) bytes += vector_bytes(v.neighbor_svs) + vector_bytes(v.neighbor_ses);
+	for (auto &e : si.SEs) bytes += vector_bytes(e.vs) + vector_bytes(e.es_link) + vector_bytes(e.vs_link) + vector_bytes(e.neighbor_ses);
+	return bytes;
+}
+size_t frame_bytes(const Frame &frame) {
+	size_t bytes = vector_bytes(frame.FVs) + vector_bytes(frame.FEs) + vector_bytes(frame.FFs) + vector_bytes(frame.FHs);
+	for (auto &v : frame.FVs) bytes += vector_bytes(v.neighbor_fvs) + vector_bytes(v.neighbor_fes) + vector_bytes(v.neighbor_ffs) + vector_bytes(v.neighbor_fhs);
+	for (auto &e : frame.FEs) bytes += vector_bytes(e.vs) + vector_bytes(e.vs_link) + vector_bytes(e.es_link) + vector_bytes(e.neighbor_fes) + vector_bytes(e.neighbor_ffs) + vector_bytes(e.neighbor_fhs);
+	for (auto &f : frame.FFs) bytes += vector_bytes(f.vs) + vector_bytes(f.es) + vector_bytes(f.fvs_net) + vector_bytes(f.ffs_net) + vector_bytes(f.neighbor_ffs) + vector_bytes(f.neighbor_fhs);
+	for (auto &h : frame.FHs) {
+		bytes += vector_bytes(h.vs) + vector_bytes(h.es) + vector_bytes(h.fs) + vector_bytes(h.fs_net) + vector_bytes(h.hs_net) + vector_bytes(h.neighbor_fhs);
+		bytes += vector_bytes(h.vs_net);
+		for (auto &layer : h.vs_net) {
+			bytes += vector_bytes(layer);
+			for (auto &row : layer) bytes += vector_bytes(row);
+		}
+	}
+	bytes += index_bytes(frame.FE_index) + index_bytes(frame.FF_index);
+	return bytes;
+}
+size_t tetralize_bytes(const Tetralize_Set &ts) {
+	size_t bytes = (ts.V.size() + ts.bc.size() + ts.sc.size() + ts.regionbc.size() + ts.RT.size()) * sizeof(double);
+	bytes += (ts.T.size() + ts.b.size() + ts.s.size() + ts.regionb.size()) * sizeof(int);
+	bytes += vector_bytes(ts.V_map) + vector_bytes(ts.Reverse_V_map) + vector_bytes(ts.Vgroups);
+	for (auto &g : ts.Vgroups) bytes += vector_bytes(g);
+	bytes += (ts.RT_cache.corners.size() + ts.RT_cache.scale.size()) * sizeof(double) + vector_bytes(ts.RT_cache.vs);
+	const Tetralize_Local &lc = ts.local;
+	bytes += (lc.V.size() + lc.sc.size() + lc.fc.C.size() + lc.fc.Axa_L.size() + lc.fc.origin_L.size() + lc.fc.normal_T.size() + lc.fc.dis_T.size()) * sizeof(double);
+	bytes += (lc.T.size() + lc.b.size() + lc.regionb.size() + lc.s.size() + lc.fc.ids_C.size() + lc.fc.ids_L.size() + lc.fc.ids_T.size()) * sizeof(int);
+	bytes += vector_bytes(lc.s_rows) + vector_bytes(lc.C_rows) + vector_bytes(lc.L_rows) + vector_bytes(lc.T_rows) + vector_bytes(lc.Vgroups);
+	for (auto &g : lc.Vgroups) bytes += vector_bytes(g);
+	return bytes;
+}
+size_t scratch_bytes(const Scratch_Pool &pool) {
+	size_t bytes = 0;
+	for (auto &f : pool.flags) bytes += vector_bytes(f.stamp);
+	for (auto &l : pool.lists) {
+		bytes += vector_bytes(l.lists) + vector_bytes(l.touched);
+		for (auto &a_list : l.lists) bytes += vector_bytes(a_list);
+	}
+	return bytes;
+}
+size_t peak_rss_bytes() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return pmc.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+	return usage.ru_maxrss;
+#else
+	return usage.ru_maxrss * 1024;
+#endif
+#endif
+}
@@ -36,6 +36,25 @@ bool comp_topology(Mesh_Topology & mt0, Mesh_Topology & mt1);
 bool redundentV_check(Mesh &meshI, Mesh &meshO);
 double average_edge_length(Mesh &mesh);
 void re_indexing_connectivity(Mesh &hmi, MatrixXi &H);
+Vs_Key vs_key(uint32_t v0, uint32_t v1);
+Vs_Key vs_key(const vector<uint32_t> &vs);
+uint32_t vs_lookup(const Vs_Index &index, const Vs_Key &key);
+//order independent hash of the hexes' vertex coordinates and valences, survives re-indexing
+uint64_t geometry_hash(const Mesh &mesh, const vector<uint32_t> &hs);
+//chained over the hexes and their corners in order, tells apart hex sets of equal geometry sum
+uint64_t ordered_geometry_hash(const Mesh &mesh, const vector<uint32_t> &hs);
+//local navigation: quad es are cyclic, cuboid fs carry fs_op
+uint32_t quad_opposite_e(const vector<uint32_t> &es, uint32_t eid);
+uint32_t cuboid_opposite_f(const Frame_H &h, uint32_t fid);
+uint32_t strip_next_f(const Mesh &mesh, uint32_t pre_f, uint32_t pre_e, uint32_t e);
+//mesh (Hybrid_E/F) or frame (Frame_E/F) elements, first id wins on duplicated tuples
+template <typename E, typename F>
+void build_vs_index(const vector<E> &Es, const vector<F> &Fs, Vs_Index &E_index, Vs_Index &F_index) {
+	E_index.clear(); F_index.clear();
+	E_index.reserve(Es.size()); F_index.reserve(Fs.size());
+	for (uint32_t i = 0; i < Es.size(); i++) E_index.emplace(vs_key(Es[i].vs[0], Es[i].vs[1]), i);
+	for (uint32_t i = 0; i < Fs.size(); i++) F_index.emplace(vs_key(Fs[i].vs), i);
+}
 
 void extract_surface_mesh(Mesh &meshi, Mesh &mesho);
 void  orient_surface_mesh(Mesh &hmi);
@@ -45,12 +64,14 @@ void  orient_triangle_mesh(MatrixXd &Tri_V, MatrixXi &Tri_F);
 Float	uctet(vector<Float> a, vector<Float> b, vector<Float> c, vector<Float> d);
 //===================================mesh quality==========================================
 bool scaled_jacobian(Mesh &hmi, Mesh_Quality &mq);
-inline Float a_jacobian(Vector3d &v0, Vector3d &v1, Vector3d &v2, Vector3d &v3);
+//minimum over the 8 corners, -1 for a degenerated corner
+double hex_scaled_jacobian(const Vector3d cs[8]);
+inline double a_jacobian(Vector3d &v0, Vector3d &v1, Vector3d &v2, Vector3d &v3);
 //===================================feature v tags==========================================
 bool triangle_mesh_feature(Mesh_Feature &mf, Mesh &hmi);
 bool initial_feature(Mesh_Feature &mf, Feature_Constraints &fc, Mesh &hmi);
 bool project_surface_update_feature(Mesh_Feature &mf, Feature_Constraints &fc, MatrixXd &V, VectorXi &b, MatrixXd &bc, uint32_t Loop = 1);
-bool phong_projection(vector<uint32_t> &tids, uint32_t Loop, uint32_t &tid, Vector3d &v, Vector3d &interpolP, Vector3d &interpolN, Vector3d &PreinterpolP, Vector3d &PreinterpolN);
+bool phong_projection(Mesh_Feature &mf, vector<uint32_t> &tids, uint32_t Loop, uint32_t &tid, Vector3d &v, Vector3d &interpolP, Vector3d &interpolN, Vector3d &PreinterpolP, Vector3d &PreinterpolN);
 void point_line_projection(const Vector3d &v1, const Vector3d &v2, const Vector3d &v, Vector3d &pv, double &t);
 void projectPointOnQuad(const vector<Vector3d>& quad_vs, vector<Vector3d> & vs_normals, const Vector3d& p, Vector2d& uv, Vector3d& interpolP, Vector3d& interpolN);
 void projectPointOnTriangle(const vector<Vector3d>& tri_vs, const vector<Vector3d> & vs_normals, const Vector3d& p, Vector2d& uv, Vector3d& interpolP, Vector3d& interpolN);
@@ -62,6 +83,14 @@ template <typename T>
 bool num_equal(const T& v1, const T& v2, const double &precision);
 
 Float rescale(Mesh &mesh, Float scaleI, bool inverse);
-void compute_referenceMesh(MatrixXd &V, vector<Hybrid> &H, vector<uint32_t> &Hs, vector<MatrixXd> &Vout);
-void hex2cuboid(MatrixXd &V, vector<uint32_t> &vs, vector<MatrixXd> &vout);
-void hex2tet24(MatrixXd &V, vector<uint32_t> &vs, double & volume);
\ No newline at end of file
+void compute_referenceMesh(const MatrixXd &V, const vector<Hybrid> &H, const vector<uint32_t> &Hs, Tet_Shapes &Vout);
+void compute_referenceMesh(const MatrixXd &V, const vector<Hybrid> &H, const vector<uint32_t> &Hs, Tet_Shapes &Vout, Reference_Cache &cache, double tolerance);
+double hex2cuboid(const MatrixXd &V, const vector<uint32_t> &vs, Tet_Shapes &vout, const uint32_t row);
+void hex2tet24(const MatrixXd &V, const vector<uint32_t> &vs, double & volume);
+//===================================memory==========================================
+size_t mesh_bytes(const Mesh &mesh);
+size_t singularity_bytes(const Singularity &si);
+size_t frame_bytes(const Frame &frame);
+size_t tetralize_bytes(const Tetralize_Set &ts);
+size_t scratch_bytes(const Scratch_Pool &pool);
+size_t peak_rss_bytes();
\ No newline at end of file
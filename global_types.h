@@ -13,9 +13,17 @@
 #pragma once
 #include <cstdlib>
 #include <vector>
+#include <array>
+#include <deque>
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
 #include "Eigen/Dense"
 using namespace Eigen;
 using namespace std;
+namespace igl { struct SLIMPattern; }
 
 /*typedefs*/
 #if defined(SINGLE_PRECISION)
@@ -23,6 +31,21 @@ typedef float Float;
 #else
 typedef double Float;
 #endif
+//storage precision; solves and accumulations stay in double
+typedef Matrix<Float, Dynamic, Dynamic> MatrixXF;
+typedef Matrix<Float, Dynamic, 1> VectorXF;
+typedef Matrix<Float, 3, 1> Vector3F;
+
+//canonical (sorted) vertex tuple of an edge or face, unused slots are (uint32_t)-1
+typedef std::array<uint32_t, 4> Vs_Key;
+struct Vs_Key_Hash {
+	size_t operator()(const Vs_Key &k) const {
+		uint64_t h = 14695981039346656037ULL;
+		for (auto v : k) { h ^= v; h *= 1099511628211ULL; }
+		return (size_t)h;
+	}
+};
+typedef std::unordered_map<Vs_Key, uint32_t, Vs_Key_Hash> Vs_Index;
 
 #define Interior_RegularE 4
 #define Boundary_RegularE 2
@@ -37,6 +60,7 @@ enum Base_Set{
 	CHORD
 };
 typedef std::tuple<uint32_t, Base_Set, Float> Tuple_Candidate;//id, type, weight
+typedef Matrix<double, Dynamic, 12, RowMajor> Tet_Shapes;//per tet: 4 corners, xyz packed
 
 enum Feature_V_Type {
 	INTERIOR = -4,
@@ -196,6 +220,7 @@ struct Frame_H
 	std::vector<uint32_t> vs;
 	std::vector<uint32_t> es;
 	std::vector<uint32_t> fs;
+	short fs_op[6];//slot of the face opposite to fs[j], -1: none
 	vector<vector<vector<uint32_t> >> vs_net;
 	vector<uint32_t>  fs_net;
 	vector<uint32_t>  hs_net;
@@ -266,6 +291,8 @@ struct Singularity
 {
 	vector<Singular_V> SVs;
 	vector<Singular_E> SEs;
+
+	void swap(Singularity &si) { SVs.swap(si.SVs); SEs.swap(si.SEs); }
 };
 struct Frame
 {
@@ -273,6 +300,10 @@ struct Frame
 	vector<Frame_E> FEs;
 	vector<Frame_F> FFs;
 	vector<Frame_H> FHs;
+	//filled by base_complex_face_extraction
+	Vs_Index FE_index, FF_index;
+
+	void swap(Frame &f) { FVs.swap(f.FVs); FEs.swap(f.FEs); FFs.swap(f.FFs); FHs.swap(f.FHs); FE_index.swap(f.FE_index); FF_index.swap(f.FF_index); }
 };
 enum Mesh_type {
 	Tri = 0,
@@ -308,8 +339,8 @@ struct Mesh_Quality
 	double min_Jacobian;
 	double ave_Jacobian;
 	double deviation_Jacobian;
-	VectorXd V_Js;
-	VectorXd H_Js;
+	VectorXF V_Js;
+	VectorXF H_Js;
 	VectorXd Num_Js;
 
 	int32_t V_num, H_num;
@@ -323,18 +354,22 @@ struct Mesh_Quality
 struct Mesh
 {
 	short type;
-	MatrixXd V;
+	MatrixXF V;
 	vector<Hybrid_V> Vs;
 	vector<Hybrid_E> Es;
 	vector<Hybrid_F> Fs;
 	vector<Hybrid> Hs;
+	//filled by build_connectivity
+	Vs_Index E_index, F_index;
+	//O(1), no deep copy
+	void swap(Mesh &m) { std::swap(type, m.type); V.swap(m.V); Vs.swap(m.Vs); Es.swap(m.Es); Fs.swap(m.Fs); Hs.swap(m.Hs); E_index.swap(m.E_index); F_index.swap(m.F_index); }
 };
 struct Mesh_Feature
 {//ground-truth feature
 	Mesh tri;
 	vector<int> V_map, V_map_reverse;
 
-	vector<Vector3d> Tcenters;
+	vector<Vector3F> Tcenters;
 	double ave_length;
 	double angle_threshold = 140.0 / 180.0 * PAI;
 
@@ -346,7 +381,7 @@ struct Mesh_Feature
 	vector<vector<uint32_t>> curve_es;
 	vector<bool> circles;
 
-	MatrixXd normal_V, normal_Tri;
+	MatrixXF normal_V, normal_Tri;
 
 	vector<int> v_types;
 };
@@ -376,11 +411,32 @@ struct Feature_Constraints
 	vector<vector<uint32_t>> curve_vs;
 	vector<int> curveIds;
 };
+//the tetralized region in its own vertex numbering, handed to SLIM every round
+struct Tetralize_Local {
+	MatrixXd V;
+	MatrixXi T;
+	VectorXi b, regionb, s;
+	MatrixXd sc;
+	vector<vector<uint32_t>> Vgroups;
+	Feature_Constraints fc;
+	//rows of s and fc inside the region; cleared by whoever reassigns ts.fc, ts.s or ts.Vgroups
+	bool rows_valid = false;
+	vector<uint32_t> s_rows, C_rows, L_rows, T_rows;
+};
+//corners each region hex's reference cuboid was built from, rows follow the hex list
+struct Reference_Cache {
+	vector<uint32_t> vs;
+	MatrixXd corners;//8 corners, xyz packed
+	VectorXd scale;//average reference edge length
+	uint64_t refreshed = 0, reused = 0;
+};
 struct Tetralize_Set {
+	//mesh vertex -> region vertex (INVALID_V outside), region vertex -> mesh vertex
 	vector<uint32_t> V_map, Reverse_V_map;
 	MatrixXd V;
 	MatrixXi T;
-	vector<MatrixXd> RT;
+	Tet_Shapes RT;
+	Reference_Cache RT_cache;
 	VectorXi b;
 	MatrixXd bc;
 	Feature_Constraints fc;
@@ -394,8 +450,103 @@ struct Tetralize_Set {
 	Eigen::VectorXi regionb;
 	Eigen::MatrixXd regionbc;
 
+	//coincidence groups for SLIM (SLIMData::Vgroups); nothing fills them at present,
+	//the collapse pins every member of a CI.V_Groups group to its target through b/bc
 	vector<vector<uint32_t>> Vgroups;
 
+	Tetralize_Local local;
+};
+//stopping rule of the smoothing rounds, the fixed iteration counts stay as upper bounds
+struct Slim_Control
+{
+	double energy_tol = 1.e-3;//relative energy decrease of a round
+	double move_tol = 1.e-3;//largest vertex move of a round / average edge length
+	double residual_tol = 1.e-2;//largest distance to the projection targets / average edge length
+	double jacobian_tol = 1.e-3;//gain of the minimum scaled jacobian counted as progress
+	uint32_t stall_rounds = 2;//rounds without energy or jacobian progress
+	//last round, measured by slim_opt and slim_converged
+	double decrease = 0, move = 0, residual = 0, min_J = -1, energy = 0;
+	//current run
+	double edge_len = 0, best_J = -1;
+	uint32_t rounds = 0, bound = 0, stalled = 0;
+	uint64_t saved = 0;//rounds skipped against the fixed counts
+	void begin(uint32_t max_rounds) { bound = max_rounds; rounds = stalled = 0; edge_len = 0; best_J = -1; }
+};
+//one overlapping piece of the domain-decomposed optimization: a base-complex cuboid and its halo rings
+struct Subdomain {
+	uint32_t color = 0;
+	vector<uint32_t> vs;//local -> mesh vertex
+	vector<uint32_t> owned;//local ids written back, every mesh vertex is owned by one subdomain
+	vector<uint32_t> frozen_vs;//mesh ids of the regionb rows, on the faces to the rest of the mesh
+	vector<Hybrid> hs;//region hexes in local ids
+	vector<uint32_t> hs_ids;
+	vector<uint32_t> C_rows, L_rows, T_rows;//rows of the mesh feature constraints inside
+	Tetralize_Set ts;//in local ids
+	std::shared_ptr<igl::SLIMPattern> pattern;
+	Slim_Control ctrl;
+};
+//flags cleared in O(1) by moving to a new epoch, storage is kept across calls
+struct Epoch_Flags
+{
+	vector<uint32_t> stamp;
+	uint32_t epoch = 0;
+	void begin(size_t n) {
+		if (stamp.size() < n) stamp.resize(n, 0);
+		if (++epoch == 0) { std::fill(stamp.begin(), stamp.end(), 0); epoch = 1; }
+	}
+	bool operator[](size_t i) const { return stamp[i] == epoch; }
+	void set(size_t i) { stamp[i] = epoch; }
+	void unset(size_t i) { stamp[i] = 0; }
+};
+//per-element lists, only the touched ones are cleared by begin()
+struct Sparse_Lists
+{
+	vector<vector<uint32_t>> lists;
+	vector<uint32_t> touched;
+	void begin(size_t n) {
+		for (auto i : touched) lists[i].clear();
+		touched.clear();
+		if (lists.size() < n) lists.resize(n);
+	}
+	void add(uint32_t i, uint32_t v) { if (lists[i].empty()) touched.push_back(i); lists[i].push_back(v); }
+	const vector<uint32_t> &operator[](size_t i) const { return lists[i]; }
+};
+//per-engine scratch, deques keep handed-out references valid while the pool grows
+struct Scratch_Pool
+{
+	std::deque<Epoch_Flags> flags;
+	std::deque<Sparse_Lists> lists;
+	uint32_t flags_used = 0, lists_used = 0;
+	Epoch_Flags &flag(size_t n) {
+		if (flags_used == flags.size()) flags.emplace_back();
+		Epoch_Flags &f = flags[flags_used++]; f.begin(n); return f;
+	}
+	Sparse_Lists &list(size_t n) {
+		if (lists_used == lists.size()) lists.emplace_back();
+		Sparse_Lists &l = lists[lists_used++]; l.begin(n); return l;
+	}
+};
+//returns everything acquired within the enclosing block
+struct Scratch_Scope
+{
+	Scratch_Pool &pool;
+	uint32_t flags_used, lists_used;
+	Scratch_Scope(Scratch_Pool &p) : pool(p), flags_used(p.flags_used), lists_used(p.lists_used) {}
+	~Scratch_Scope() { pool.flags_used = flags_used; pool.lists_used = lists_used; }
+};
+//early-reject predicates of a candidate, see simplification::filter_cascade
+enum Filter_Stage {
+	STRUCTURE_FILTER = 0,//valence, fake and type flags
+	BOUNDARY_FILTER,//sheet cuboids squeezed between two boundary faces
+	GROUP_FILTER,//vertex groups
+	FEATURE_FILTER,//target surface and feature conflicts
+	JACOBIAN_FILTER,//scaled jacobian predicted from the collapsed targets
+	TOPOLOGY_FILTER,//collapse and base complex rebuild
+	FILTER_NUM
+};
+struct Filter_Counter {
+	uint64_t calls = 0, rejects = 0;
+	double ms = 0;
 };
 struct Collapse_Info {
 	vector<vector<uint32_t>> V_Groups;	
@@ -408,49 +559,44 @@ struct Collapse_Info {
 	vector<uint32_t> fs_subdivided, subd_region;
 
 	vector<uint32_t> Hsregion;
+	//pre-collapse copies of the Hsregion hexes, indexed by region_ids
+	vector<Hybrid> region_hs;
+	vector<uint32_t> region_ids;
+};
+//undo log of a collapse applied in place: derived containers are moved aside,
+//hex and vertex edits are logged per slot so a rollback only touches the region
+struct Collapse_Journal
+{
+	bool active = false;
+	uint32_t V_num = 0, H_num = 0;//sizes before the collapse
+	vector<Hybrid_V> Vs;
+	vector<Hybrid_E> Es;
+	vector<Hybrid_F> Fs;
+	Vs_Index E_index, F_index;
+	vector<vector<uint32_t>> hs_fs, hs_es;
+	vector<pair<uint32_t, vector<uint32_t>>> hs_vs;//slot, vs before the remap
+	vector<pair<uint32_t, Hybrid>> hs_removed;//slot, removed hex
+	vector<pair<uint32_t, uint32_t>> hs_moved, vs_moved;//hole, mover
+	vector<pair<uint32_t, Vector3F>> coords;//slot, coordinate before
+	vector<pair<uint32_t, Vector3F>> smoothed;//slot in the collapsed mesh, coordinate before the smoothing wrote it
+};
+struct Batch_Job
+{//one line of a batch manifest
+	std::string choice, path;
+	double hex_num_ratio = 1.0;
+	int iteration_base = 2;
+	double tobe_removed_cuboid_ratio = 0.9;
+	bool hard_feature = true;
+	double hausdorff_ratio_t = 0.01;
+	size_t memory_budget = 0;//MB, 0: unlimited
+	uint32_t batch_size = 1;
+	double deadline = 0;//seconds, 0: none
+	double predict_jacobian = -1;//-1: off
+	//summary
+	bool success = false;
+	uint32_t H_num_in = 0, H_num_out = 0;
+	double min_Jacobian = 0, ave_Jacobian = 0;
+	double hausdorff_ratio = 0;
+	size_t timing = 0;
+	size_t peak_memory = 0;//largest memory held by the job's structures, MB
 };
-
-extern Mesh_Feature mf;
-
-extern vector<MatrixXi> LocalMeshTri_F;
-extern vector<MatrixXd> LocalMeshTri_V;
-extern vector<VectorXd> LocalMeshTri_C;
-extern vector<MatrixXi> LocalMeshEs;
-
-extern vector<Feature_Constraints> SeLocalProjection;
-
-extern vector<MatrixXi> MeshTri_F;
-extern vector<MatrixXd> MeshTri_V, MeshTri_N, MeshTri_VN;
-extern vector<VectorXd> MeshTri_C;
-extern vector<MatrixXi> MeshEs;
-
-extern vector<MatrixXi> SkeletonTri_F;
-extern vector<MatrixXd> SkeletonTri_V;
-extern vector<MatrixXd> SkeletonTri_N;
-extern vector<MatrixXd> SkeletonTri_C;
-
-
-extern vector<MatrixXi> FrameTri_F;
-extern vector<MatrixXd> FrameTri_V, FrameTri_N;
-extern vector<VectorXd> FrameTri_C;
-
-extern vector<MatrixXi> MeshSkeletonTri_F;
-extern vector<MatrixXd> MeshSkeletonTri_V, MeshSkeletonTri_N, MeshSkeletonTri_VN;
-extern vector<VectorXd> MeshSkeletonTri_C;
-extern vector<VectorXd> AOSkeletons;
-extern vector<VectorXd> AOs;
-
-extern vector<MatrixXi> CollapseTri_F;
-extern vector<MatrixXd> CollapseTri_V, CollapseTri_N;
-extern vector<VectorXd> CollapseTri_C;
-
-extern char path_out[300];
-//parallel
-extern int32_t GRAIN_SIZE;
-//meshes
-extern MatrixXd tenC, tenC_perm;
-
-extern double diagonal_len;
-//temporary
-extern Mesh mesh_sheet, mesh_sheetS;
-extern bool HEXAHEDRAL_COLLASPE;
\ No newline at end of file
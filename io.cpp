@@ -33,7 +33,7 @@ void h_io::read_hybrid_mesh_OFF(Mesh &hmi, char *path)
 		v.v[0] = x;
 		v.v[1] = y;
 		v.v[2] = z;
-		hmi.V.col(i) = Vector3d(x, y, z);
+		hmi.V.col(i) = Vector3F(x, y, z);
 		v.id = i;
 		v.boundary = false;
 		hmi.Vs.push_back(v);
@@ -624,12 +624,12 @@ void h_io::write_Vs_Groups_VTK(Mesh &mesh, vector<vector<uint32_t>> &Vs_Group, c
 	constraint_Num = 0;
 	for (auto vs : Vs_Group) {
 		Vector3d v; v.setZero();
-		for (auto vid : vs) v = v + mesh.V.col(vid);
+		for (auto vid : vs) v = v + mesh.V.col(vid).cast<double>();
 		v = v / vs.size();
 		for (auto vid : vs) {
 			b[constraint_Num] = vid;
 			//bc.row(constraint_Num) = v;
-			bc.row(constraint_Num) = mesh.V.col(vid);
+			bc.row(constraint_Num) = mesh.V.col(vid).cast<double>();
 			constraint_Num++;
 		}
 	}
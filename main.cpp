@@ -11,6 +11,9 @@
 // obtain one at http://mozilla.org/MPL/2.0/.
 
 #include "simplification.h"
+#include "timer.h"
+#include <fstream>
+#include <sstream>
 char path_IOH[300];
 char Choices[300]="SIM";
 char Hex_NUM_Ratio[300]="1.0";
@@ -18,16 +21,176 @@ char Iteration_Base[300] = "2";
 char ToBe_Removed_Cuboid_Ratio[300] = "0.9";
 char Hard_Feature[300] = "1";
 char Hausdorff_ratio_t[300] = "0.01";
+char Memory_Budget[300] = "0";
+char Batch_Size[300] = "1";
+char Deadline[300] = "0";
+char Predict_Jacobian[300] = "-1";
+char path_Ref[300];
 char temp_string[300];
-h_io io;
-base_complex bc;
-simplification sim;
+
+bool run_job(Batch_Job &job) {
+	Timer<> timer;
+	h_io io;
+	base_complex bc;
+	simplification sim;
+	char path[300];
+
+	sprintf(path, "%s", job.path.c_str());
+	sprintf(sim.path_out, "%s", path);
+
+	sim.mesh.type = Mesh_type::Hex;
+	io.read_hybrid_mesh_VTK(sim.mesh, path);
+	build_connectivity(sim.mesh);
+	bc.singularity_structure(sim.si, sim.mesh);
+	bc.base_complex_extraction(sim.si, sim.frame, sim.mesh);
+	job.H_num_in = sim.mesh.Hs.size();
+
+	sim.set_sharp_feature(job.hard_feature);
+	sim.set_slim_iteration_base(job.iteration_base);
+	sim.set_cuboid_ratio(job.tobe_removed_cuboid_ratio);
+	if (job.hex_num_ratio > 10)sim.set_target_hex_num(job.hex_num_ratio);
+	else sim.set_target_hex_num(job.hex_num_ratio * sim.mesh.Hs.size());
+	sim.set_memory_budget(job.memory_budget);
+	sim.set_batch_size(job.batch_size);
+	if (job.deadline) sim.set_deadline(job.deadline * 1000);
+	sim.set_predict_jacobian_bound(job.predict_jacobian);
+
+	if (job.choice == "SIM") {
+		//simplification
+		sim.hausdorff_ratio_threshould = job.hausdorff_ratio_t;
+		if (!sim.initialize()) return false;
+		sim.pipeline();
+	}
+	else if (job.choice == "OPT" || job.choice == "OPT_DD" || job.choice == "OPT_LOCAL" || job.choice == "OPT_ML") {
+		//optimization
+		if (job.choice == "OPT_DD") sim.set_domain_decomposition(2);
+		if (job.choice == "OPT_LOCAL") sim.set_quality_target(0.5);
+		if (job.choice == "OPT_ML") sim.set_multilevel(true);
+		if (!sim.initialize()) return false;
+		sim.optimization();
+		sprintf(path, "%s%s", job.path.c_str(), "_optimized.vtk");
+		io.write_hybrid_mesh_VTK(sim.mesh, path);
+	}
+	else if (job.choice == "BENCH") {
+		//smoothing solver comparison, the mesh is left unchanged
+		if (!sim.initialize()) return false;
+		sim.slim_benchmark();
+	}
+	else {
+		cout << "unknown processing type " << job.choice << endl; return false;
+	}
+
+	Mesh_Quality mq;
+	scaled_jacobian(sim.mesh, mq);
+	job.H_num_out = sim.mesh.Hs.size();
+	job.min_Jacobian = mq.min_Jacobian;
+	job.ave_Jacobian = mq.ave_Jacobian;
+	job.hausdorff_ratio = sim.hausdorff_ratio;
+	job.timing = timer.value();
+	sim.memory_bytes();
+	job.peak_memory = sim.memory_peak / (1024 * 1024);
+	job.success = true;
+	return true;
+}
+bool read_manifest(const char *path, vector<Batch_Job> &jobs) {
+	//one job per line: c r b s f i [h [m [k [t [j]]]]], same order as the command line; # starts a comment
+	std::ifstream f(path);
+	if (!f.is_open()) {
+		cout << "cannot open manifest " << path << endl; return false;
+	}
+	std::string line;
+	while (std::getline(f, line)) {
+		if (line.empty() || line[0] == '#') continue;
+		std::istringstream ss(line);
+		Batch_Job job;
+		if (!(ss >> job.choice >> job.hex_num_ratio >> job.iteration_base >> job.tobe_removed_cuboid_ratio >> job.hard_feature >> job.path)) {
+			cout << "skip manifest line: " << line << endl; continue;
+		}
+		ss >> job.hausdorff_ratio_t >> job.memory_budget >> job.batch_size >> job.deadline >> job.predict_jacobian;
+		jobs.push_back(job);
+	}
+	return true;
+}
+void write_report(const char *path, vector<Batch_Job> &jobs) {
+	std::ofstream f(path);
+	f << "# input type status #H_in #H_out min_J ave_J hausdorff_ratio time_ms memory_MB" << endl;
+	for (auto &job : jobs)
+		f << job.path << " " << job.choice << " " << (job.success ? "OK" : "FAILED") << " " << job.H_num_in << " " << job.H_num_out << " "
+		<< job.min_Jacobian << " " << job.ave_Jacobian << " " << job.hausdorff_ratio << " " << job.timing << " " << job.peak_memory << endl;
+	f.close();
+}
 int main( int argc, char* argv[] )
 {
 	//int nprocess = -1;
 	//tbb::task_scheduler_init init(nprocess == -1 ? tbb::task_scheduler_init::automatic: nprocess);
+	if (argc > 1) sprintf(Choices, "%s", argv[1]);
 
-	if (strcmp(Choices, "SIM") == 0 || strcmp(Choices, "OPT") == 0) {
+	if (strcmp(Choices, "CMP") == 0) {
+		//precision validation: compare a result against the double-precision reference
+		if (argc < 4) {
+			cout << "usage: CMP reference.vtk result.vtk" << endl; return 1;
+		}
+		h_io io;
+		simplification sim;
+		sprintf(path_Ref, "%s", argv[2]);
+		sprintf(path_IOH, "%s", argv[3]);
+		Mesh ref, res; ref.type = res.type = Mesh_type::Hex;
+		io.read_hybrid_mesh_VTK(ref, path_Ref);
+		io.read_hybrid_mesh_VTK(res, path_IOH);
+		if (ref.Vs.size() != res.Vs.size() || ref.Hs.size() != res.Hs.size()) {
+			cout << "different connectivity: V " << ref.Vs.size() << " vs " << res.Vs.size() << ", H " << ref.Hs.size() << " vs " << res.Hs.size() << endl;
+		}
+		else {
+			double max_dev = 0, diag = (ref.V.rowwise().maxCoeff() - ref.V.rowwise().minCoeff()).cast<double>().norm();
+			for (uint32_t i = 0; i < ref.V.cols(); i++)
+				max_dev = std::max(max_dev, (ref.V.col(i).cast<double>() - res.V.col(i).cast<double>()).norm());
+			cout << "max vertex deviation / diagonal: " << max_dev / diag << endl;
+		}
+		build_connectivity(ref);
+		build_connectivity(res);
+		Mesh_Quality mq_ref, mq_res;
+		scaled_jacobian(ref, mq_ref);
+		scaled_jacobian(res, mq_res);
+		cout << "reference: minimum scaled J: " << mq_ref.min_Jacobian << " average scaled J: " << mq_ref.ave_Jacobian << endl;
+		cout << "result (" << (sizeof(Float) == sizeof(float) ? "single" : "double") << "): minimum scaled J: " << mq_res.min_Jacobian << " average scaled J: " << mq_res.ave_Jacobian << endl;
+		cout << "minimum scaled J difference: " << mq_res.min_Jacobian - mq_ref.min_Jacobian << endl;
+
+		Mesh_Feature mf_ref;
+		triangle_mesh_feature(mf_ref, ref);
+		sim.hausdorff_ratio_threshould = 1.0;
+		sim.hausdorff_ratio_check(mf_ref.tri, res);
+		cout << "hausdorff ratio: " << sim.hausdorff_ratio << endl;
+		return 0;
+	}
+	if (strcmp(Choices, "BATCH") == 0) {
+		//many meshes in one process, at most #concurrency jobs at a time
+		if (argc < 3) {
+			cout << "usage: BATCH manifest.txt [concurrency] [report]" << endl; return 1;
+		}
+		vector<Batch_Job> jobs;
+		if (!read_manifest(argv[2], jobs)) return 1;
+		int concurrency = tbb::task_scheduler_init::default_num_threads();
+		if (argc > 3) concurrency = std::max(1, std::stoi(argv[3]));
+		char path_report[300];
+		if (argc > 4) sprintf(path_report, "%s", argv[4]);
+		else sprintf(path_report, "%s%s", argv[2], "_report.txt");
+
+		Timer<> timer;
+		tbb::task_arena arena(concurrency);
+		arena.execute([&] {
+			tbb::parallel_for(tbb::blocked_range<uint32_t>(0u, (uint32_t)jobs.size(), 1),
+				[&](const tbb::blocked_range<uint32_t> &range) {
+				for (uint32_t i = range.begin(); i != range.end(); i++) run_job(jobs[i]);
+			});
+		});
+		write_report(path_report, jobs);
+
+		uint32_t succeeded = 0;
+		for (auto &job : jobs) if (job.success) succeeded++;
+		cout << "batch: " << succeeded << "/" << jobs.size() << " jobs succeeded in " << timer.value() << "ms, report: " << path_report << endl;
+		return succeeded == jobs.size() ? 0 : 1;
+	}
+	if (strcmp(Choices, "SIM") == 0 || strcmp(Choices, "OPT") == 0 || strcmp(Choices, "OPT_DD") == 0 || strcmp(Choices, "OPT_LOCAL") == 0 || strcmp(Choices, "OPT_ML") == 0 || strcmp(Choices, "BENCH") == 0) {
 		if (argc != 7) {
 			cout << "#parameters are not exactly 7!" << endl;
 		}
@@ -36,62 +199,46 @@ int main( int argc, char* argv[] )
 		sprintf(ToBe_Removed_Cuboid_Ratio, "%s", argv[4]);
 		sprintf(Hard_Feature, "%s", argv[5]);
 		sprintf(path_IOH, "%s", argv[6]);
-		if(argc == 8) sprintf(Hausdorff_ratio_t, "%s", argv[7]);
+		if(argc >= 8) sprintf(Hausdorff_ratio_t, "%s", argv[7]);
+		if(argc >= 9) sprintf(Memory_Budget, "%s", argv[8]);
+		if(argc >= 10) sprintf(Batch_Size, "%s", argv[9]);
+		if(argc >= 11) sprintf(Deadline, "%s", argv[10]);
+		if(argc >= 12) sprintf(Predict_Jacobian, "%s", argv[11]);
 	}
-	sprintf(path_out,"%s",path_IOH);
 
-	sim.mesh.type = Mesh_type::Hex;
-	io.read_hybrid_mesh_VTK(sim.mesh, path_IOH);
-	build_connectivity(sim.mesh);
-	bc.singularity_structure(sim.si, sim.mesh);
-	bc.base_complex_extraction(sim.si, sim.frame, sim.mesh);
-
-	double hex_num_ratiod = 0.9, tobe_removed_cuboid_ratio = 1.0, hausdorff_ratio_td = 0.01;
-	int iteration_base = 3;
-	bool hard_feature = false;
+	Batch_Job job;
+	job.choice = Choices;
+	job.path = path_IOH;
 
 	std::string::size_type sz;
 	if (strcmp(Hex_NUM_Ratio, " ") != 0)
-		hex_num_ratiod = std::stod(Hex_NUM_Ratio, &sz);
+		job.hex_num_ratio = std::stod(Hex_NUM_Ratio, &sz);
 
 	if (strcmp(Iteration_Base, " ") != 0)
-		iteration_base = std::stoi(Iteration_Base, &sz);
+		job.iteration_base = std::stoi(Iteration_Base, &sz);
 
 	if (strcmp(ToBe_Removed_Cuboid_Ratio, " ") != 0)
-		tobe_removed_cuboid_ratio = std::stod(ToBe_Removed_Cuboid_Ratio, &sz);
+		job.tobe_removed_cuboid_ratio = std::stod(ToBe_Removed_Cuboid_Ratio, &sz);
 
 	if (strcmp(Hard_Feature, " ") != 0)
-		hard_feature = std::stoi(Hard_Feature, &sz);
+		job.hard_feature = std::stoi(Hard_Feature, &sz);
 
 	if (strcmp(Hausdorff_ratio_t, " ") != 0)
-		hausdorff_ratio_td = std::stod(Hausdorff_ratio_t, &sz);
+		job.hausdorff_ratio_t = std::stod(Hausdorff_ratio_t, &sz);
 
-	if (strcmp(Choices, "SIM") == 0){
-		//simplification
-		sim.set_sharp_feature(hard_feature);
-		sim.set_slim_iteration_base(iteration_base);
-		sim.set_cuboid_ratio(tobe_removed_cuboid_ratio);
-		if (hex_num_ratiod > 10)sim.set_target_hex_num(hex_num_ratiod);
-		else sim.set_target_hex_num(hex_num_ratiod * sim.mesh.Hs.size());
-		sim.hausdorff_ratio_threshould = hausdorff_ratio_td;
+	if (strcmp(Memory_Budget, " ") != 0)
+		job.memory_budget = std::stoul(Memory_Budget, &sz);
 
-		if (!sim.initialize()) return false;
-		sim.pipeline();
-	}
-	else if (strcmp(Choices, "OPT") == 0) {
-		//optimization
-		sim.set_sharp_feature(hard_feature);
-		sim.set_slim_iteration_base(iteration_base);
-		sim.set_cuboid_ratio(tobe_removed_cuboid_ratio);
-		if (hex_num_ratiod > 10)sim.set_target_hex_num(hex_num_ratiod);
-		else sim.set_target_hex_num(hex_num_ratiod * sim.mesh.Hs.size());
+	if (strcmp(Batch_Size, " ") != 0)
+		job.batch_size = std::stoul(Batch_Size, &sz);
 
-		if (!sim.initialize()) return false;
-		sim.optimization();
-		char path[300];
-		sprintf(path, "%s%s", path_IOH, "_optimized.vtk");
-		io.write_hybrid_mesh_VTK(sim.mesh, path);
-	}
+	if (strcmp(Deadline, " ") != 0)
+		job.deadline = std::stod(Deadline, &sz);
+
+	if (strcmp(Predict_Jacobian, " ") != 0)
+		job.predict_jacobian = std::stod(Predict_Jacobian, &sz);
+
+	if (!run_job(job)) return false;
 	
 	return 0;
 }
\ No newline at end of file
@@ -12,6 +12,7 @@
 
 #include "simplification.h"
 #include "timer.h"
+#include <atomic>
 void simplification::pipeline() {
 
 	vector<unsigned long long> timings;
@@ -35,19 +36,28 @@ void simplification::pipeline() {
 		//stopping criterions
 		if (Remove_Iteration != 0 && removed_candidates >= Remove_Iteration) break;
 		if (remove_cuboid_ratio != 0 && (double)(cuboid_num_original - frame.FHs.size()) / cuboid_num_original >= remove_cuboid_ratio) break;
+		if (!time_for(candidate_ms + update_ms)) {
+			cout << "deadline: stop removing, " << remaining_ms() << "ms left" << endl; break;
+		}
 
-		if (!remove()) {
-			break; }
+		uint32_t removed = Batch_Size > 1 ? remove_batch() : 0;
+		if (!removed) {
+			if (!remove()) break;
+			removed = 1;
+		}
+		check_memory_budget();
 		timer.endStage("end removing");
 		timer0 = timer.value();
 		timings.push_back(timer0);
 
+		Timer<> update_timer;
 		extract();
 		ranking();
 		subdivision();
+		update_ms = update_timer.value();
 
 		double remove_cs_ratio = (double)(cuboid_num_original - frame.FHs.size()) / cuboid_num_original;
-		removed_candidates++;
+		removed_candidates += removed;
 	}
 
 	scaled_jacobian(mesh, mq);
@@ -55,6 +65,11 @@ void simplification::pipeline() {
 	std::cout << "B_V B_E B_F B_H: " << frame.FVs.size() << " " << frame.FEs.size() << " " << frame.FFs.size() << " " << frame.FHs.size() << endl;
 	std::cout << "#sheets removed: " << (double)(sheet_num_original - All_Sheets.size()) << endl;
 	std::cout << "Removed Component Ratio: " << (double)(cuboid_num_original - frame.FHs.size()) / cuboid_num_original << endl;
+	std::cout << "#rejected candidates skipped: " << rejected_skips << endl;
+	filter_report();
+	std::cout << "#smoothing rounds saved: " << slim_ctrl.saved << endl;
+	std::cout << "#reference cuboids reused: " << ts.RT_cache.reused << " rebuilt: " << ts.RT_cache.refreshed << endl;
+	memory_report("simplified");
 
 	char path[300];
 
@@ -98,10 +113,12 @@ bool simplification::initialize() {
 }
 void simplification::extract() {
 	std::vector<Sheet>().swap(All_Sheets);
+	FE_sheet.assign(frame.FEs.size(), INVALID_E);
 	std::vector<bool> e_flag(frame.FEs.size(), false);
+	uint32_t e_seed = 0;
 	while (true) {
 		uint32_t eid = INVALID_E;
-		for (uint32_t i = 0; i < frame.FEs.size(); i++) if (!e_flag[i]) { eid = i; break; }
+		for (; e_seed < frame.FEs.size(); e_seed++) if (!e_flag[e_seed]) { eid = e_seed; break; }
 		if (eid == INVALID_E) break;
 
 		Sheet sheet; sheet.id = All_Sheets.size();
@@ -111,10 +128,10 @@ void simplification::extract() {
 			uint32_t eid = e_pool.front(); e_pool.pop();
 			if (e_flag[eid]) continue; e_flag[eid] = true;
 			sheet.middle_es.push_back(eid);
+			FE_sheet[eid] = sheet.id;
 			for (uint32_t i = 0; i < frame.FEs[eid].neighbor_ffs.size(); i++) {
 				uint32_t fid = frame.FEs[eid].neighbor_ffs[i];
-				uint32_t pos = std::find(frame.FFs[fid].es.begin(), frame.FFs[fid].es.end(), eid) - frame.FFs[fid].es.begin();
-				uint32_t op_eid = frame.FFs[fid].es[(pos+2)%4];
+				uint32_t op_eid = quad_opposite_e(frame.FFs[fid].es, eid);
 				if (e_flag[op_eid]) continue;
 				e_pool.push(op_eid);
 			}
@@ -128,11 +145,12 @@ void simplification::extract() {
 
 	std::vector<CHord>().swap(All_Chords);
 	vector<bool> f_flag(frame.FFs.size(),false);
+	uint32_t f_seed = 0;
 	while (true)
 	{
 		uint32_t fid = -1;
-		for (uint32_t i = 0; i<f_flag.size(); i++){
-			if (!f_flag[i]) { fid = i; break; }
+		for (; f_seed<f_flag.size(); f_seed++){
+			if (!f_flag[f_seed]) { fid = f_seed; break; }
 		}
 		if (fid == -1) break;
 
@@ -167,17 +185,16 @@ bool simplification::build_sheet_info(uint32_t sheet_id){
 		if (frame.FEs[eid].boundary) middle_es_b.push_back(eid);
 	}
 	if(!middle_es_b.size()) All_Sheets[sheet_id].type = Sheet_type::close;
-	vector<short> V_flag(frame.FVs.size(), 0);
+	Scratch_Scope scope(pool);
+	Epoch_Flags &V_flag = pool.flag(frame.FVs.size());
 	for (auto eid : middle_es) {
 		uint32_t v1 = frame.FEs[eid].vs[0];
 		uint32_t v2 = frame.FEs[eid].vs[1];
-		V_flag[v1]++;
-		V_flag[v2]++;
-
-		if (V_flag[v1] > 1 || V_flag[v2] > 1) {
+		if (V_flag[v1] || V_flag[v2]) {
 			All_Sheets[sheet_id].type = Sheet_type::tagent;
 			break;
 		}
+		V_flag.set(v1); V_flag.set(v2);
 	}
 	sort(middle_fs.begin(), middle_fs.end());
 	for (auto cid:cs){
@@ -201,11 +218,11 @@ bool simplification::build_sheet_info(uint32_t sheet_id){
 
 	vector<uint32_t> &twoside_fs = All_Sheets[sheet_id].side_fs;
 
-	vector<bool> F_flag(frame.FFs.size(),true);
-	for (auto fid : middle_fs)F_flag[fid] = false;
-	for (auto fid : fs) if(F_flag[fid]) twoside_fs.push_back(fid);
-	fill(F_flag.begin(), F_flag.end(), false);
-	for (auto fid : twoside_fs)F_flag[fid] = true;
+	Epoch_Flags &M_flag = pool.flag(frame.FFs.size());
+	for (auto fid : middle_fs) M_flag.set(fid);
+	for (auto fid : fs) if(!M_flag[fid]) twoside_fs.push_back(fid);
+	Epoch_Flags &F_flag = pool.flag(frame.FFs.size());
+	for (auto fid : twoside_fs) F_flag.set(fid);
 
 	if (!twoside_fs.size()) { cout << "ERROR, no side fs" << endl; system("PAUSE"); }
 
@@ -213,7 +230,7 @@ bool simplification::build_sheet_info(uint32_t sheet_id){
 	fs_pool.push(twoside_fs[0]);
 	while (!fs_pool.empty()){
 		auto fid = fs_pool.front(); fs_pool.pop();
-		if (!F_flag[fid]) continue; F_flag[fid] = false;
+		if (!F_flag[fid]) continue; F_flag.unset(fid);
 		left_fs.push_back(fid);
 
 		for (auto eid: frame.FFs[fid].es)
@@ -258,25 +275,12 @@ CHord simplification::extract_chord(uint32_t &fid, vector<bool> &f_flag) {
 	vector<uint32_t> fs, fs_right;
 	fs.push_back(cur_f);
 	while (true) {
-		Frame_F f_ = frame.FFs[cur_f];
-		Frame_H h_ = frame.FHs[cur_h];
-
-		std::vector<uint32_t> &vs = f_.vs;
-		std::sort(vs.begin(), vs.end());
-		short cors_f = -1;
-		for (uint32_t j = 0; j < 6; j++) {
-			std::vector<uint32_t> vsj = frame.FFs[h_.fs[j]].vs;
-			std::sort(vsj.begin(), vsj.end());
-			std::vector<uint32_t> common_vs;
-			std::set_intersection(vs.begin(), vs.end(), vsj.begin(), vsj.end(), std::back_inserter(common_vs));
-			if (common_vs.size())continue; else { cors_f = j; break; }
-		}
-		if(cors_f == -1) {
+		uint32_t neighbor_f = cuboid_opposite_f(frame.FHs[cur_h], cur_f);
+		if(neighbor_f == INVALID_E) {
 			cout << "problematic cuboid" << endl; system("PAUSE"); 
 		}
-		uint32_t neighbor_f = h_.fs[cors_f];
 		uint32_t neighbor_h = -1;
-		Frame_F f = frame.FFs[neighbor_f];
+		const Frame_F &f = frame.FFs[neighbor_f];
 
 		for (auto fhid: f.neighbor_fhs) if (fhid != cur_h) neighbor_h = fhid;
 
@@ -296,30 +300,17 @@ CHord simplification::extract_chord(uint32_t &fid, vector<bool> &f_flag) {
 		cur_h = frame.FFs[cur_f].neighbor_fhs[1];
 
 		while (true) {
-			Frame_F f_ = frame.FFs[cur_f];
-			Frame_H h_ = frame.FHs[cur_h];
-
-			std::vector<uint32_t> &vs = f_.vs;
-			std::sort(vs.begin(), vs.end());
-			short cors_f = -1;
-			for (uint32_t j = 0; j < 6; j++) {
-				std::vector<uint32_t> vsj = frame.FFs[h_.fs[j]].vs;
-				std::sort(vsj.begin(), vsj.end());
-				std::vector<uint32_t> common_vs;
-				std::set_intersection(vs.begin(), vs.end(), vsj.begin(), vsj.end(), std::back_inserter(common_vs));
-				if (common_vs.size())continue; else { cors_f = j; break; }
-			}
-			if (cors_f == -1) { 
+			uint32_t neighbor_f = cuboid_opposite_f(frame.FHs[cur_h], cur_f);
+			if (neighbor_f == INVALID_E) { 
 				cout << "problematic cuboid" << endl; system("PAUSE"); 
 			}
-			uint32_t neighbor_f = h_.fs[cors_f];
 
 			if (find(fs.begin(), fs.end(), neighbor_f) != fs.end()) {
 				cout << "problematic cuboid" << endl; system("PAUSE"); 
 			}
 
 			uint32_t neighbor_h = -1;
-			Frame_F f = frame.FFs[neighbor_f];
+			const Frame_F &f = frame.FFs[neighbor_f];
 
 			for (auto fhid : f.neighbor_fhs) if (fhid != cur_h) neighbor_h = fhid;
 
@@ -382,6 +373,15 @@ CHord simplification::extract_chord(uint32_t &fid, vector<bool> &f_flag) {
 	}
 	return cc;
 }
+uint32_t simplification::cuboid_face(uint32_t hid, const vector<uint32_t> &vs) {
+	uint32_t fid = vs_lookup(frame.FF_index, vs_key(vs));
+	const vector<uint32_t> &fs = frame.FHs[hid].fs;
+	if (fid != INVALID_E && find(fs.begin(), fs.end(), fid) != fs.end()) return fid;
+	//duplicated corner tuples, match inside the cuboid
+	Vs_Key key = vs_key(vs);
+	for (auto cfid : fs) if (vs_key(frame.FFs[cfid].vs) == key) return cfid;
+	return INVALID_E;
+}
 bool simplification::build_chord_info(uint32_t id) {
 	CHord &cc = All_Chords[id];
 	cc.fake = false;
@@ -413,18 +413,7 @@ bool simplification::build_chord_info(uint32_t id) {
 				vs.push_back(cc.parallel_ns[(i + 1) % 4][j - 1]);
 				vs.push_back(cc.parallel_ns[i][j - 1]);
 
-				int hid = cc.cs[j-1]; fid = -1;
-				for (uint32_t k = 0; k < 6; k++) {
-					fid = frame.FHs[hid].fs[k];
-					vector<uint32_t> &vs1 = frame.FFs[fid].vs;
-					bool equal = true;
-					for (auto vid1 : vs1) {
-						bool found = false;
-						for (auto vid0 : vs) { if (vid1 == vid0) { found = true; break; } }
-						if (!found) { equal = false; break; }
-					}
-					if (equal) break;
-				}
+				fid = cuboid_face(cc.cs[j-1], vs);
 				if (fid == -1) { cout << "error in build chord info" << endl; system("PAUSE"); }
 				cc.vertical_fs[i].push_back(fid);
 
@@ -441,18 +430,7 @@ bool simplification::build_chord_info(uint32_t id) {
 				vs.push_back(cc.parallel_ns[(i + 1) % 4][0]);
 				vs.push_back(cc.parallel_ns[i][0]);
 
-				int hid = cc.cs[j]; fid = -1;
-				for (uint32_t k = 0; k < 6; k++) {
-					fid = frame.FHs[hid].fs[k];
-					vector<uint32_t> &vs1 = frame.FFs[fid].vs;
-					bool equal = true;
-					for (auto vid1 : vs1) {
-						bool found = false;
-						for (auto vid0 : vs) { if (vid1 == vid0) { found = true; break; } }
-						if (!found) { equal = false; break; }
-					}
-					if (equal) break;
-				}
+				fid = cuboid_face(cc.cs[j], vs);
 				if (fid == -1) { cout << "error in build chord info" << endl; system("PAUSE"); }
 				cc.vertical_fs[i].push_back(fid);
 
@@ -469,20 +447,21 @@ bool simplification::build_chord_info(uint32_t id) {
 	for (uint32_t i = 0; i<4; i++) cc.ns.insert(cc.ns.end(), cc.parallel_ns[i].begin(), cc.parallel_ns[i].end());
 	for (uint32_t i = 0; i<4; i++) cc.es.insert(cc.es.end(), cc.parallel_es[i].begin(), cc.parallel_es[i].end());
 	for (uint32_t i = 0; i<4; i++) cc.es.insert(cc.es.end(), cc.vertical_es[i].begin(), cc.vertical_es[i].end());
-	vector<bool> Vs_Ind(frame.FVs.size(), false), Es_Ind(frame.FEs.size(), false), Fs_Ind(frame.FFs.size(), false), Hs_Ind(frame.FHs.size(), false);
+	Scratch_Scope scope(pool);
+	Epoch_Flags &Vs_Ind = pool.flag(frame.FVs.size()), &Es_Ind = pool.flag(frame.FEs.size()), &Fs_Ind = pool.flag(frame.FFs.size()), &Hs_Ind = pool.flag(frame.FHs.size());
 
 	for (auto vid : cc.ns) {
-		if (Vs_Ind[vid]) cc.tangent_vs.push_back(vid); Vs_Ind[vid] = true;
+		if (Vs_Ind[vid]) cc.tangent_vs.push_back(vid); Vs_Ind.set(vid);
 	}
 	for (auto eid : cc.es) {
-		if (Es_Ind[eid]) cc.tangent_es.push_back(eid); Es_Ind[eid] = true;
+		if (Es_Ind[eid]) cc.tangent_es.push_back(eid); Es_Ind.set(eid);
 	}
 	for (auto cid : cc.cs) {
-		if (Hs_Ind[cid]) cc.tangent_cs.push_back(cid); Hs_Ind[cid] = true;
+		if (Hs_Ind[cid]) cc.tangent_cs.push_back(cid); Hs_Ind.set(cid);
 	}
 	for (uint32_t i = 0; i<4; i++){
 		for (auto fid : cc.vertical_fs[i]) {
-			if (Fs_Ind[fid]) cc.tangent_fs.push_back(fid); Fs_Ind[fid] = true;
+			if (Fs_Ind[fid]) cc.tangent_fs.push_back(fid); Fs_Ind.set(fid);
 		}
 	}
 	if (cc.tangent_vs.size() || cc.tangent_es.size() || cc.tangent_fs.size() || cc.tangent_cs.size())
@@ -491,14 +470,10 @@ bool simplification::build_chord_info(uint32_t id) {
 	vector<uint32_t> sheet_ids;
 	for (int i = 0; i < 2; i++) {
 		uint32_t feid = cc.parallel_es[i][0];
-		int sheet_id = -1;
-		for (auto sheet : All_Sheets)
-			if (find(sheet.middle_es.begin(), sheet.middle_es.end(), feid) != sheet.middle_es.end()) {
-				sheet_id = sheet.id;
-				if (sheet.fake) cc.fake = true;
-				sheet_ids.push_back(sheet.id); break;
-			}
-		if (sheet_id == -1) { cout << "doesnot find the longer sheet" << endl; system("PAUSE"); }
+		uint32_t sheet_id = FE_sheet[feid];
+		if (sheet_id == INVALID_E) { cout << "doesnot find the longer sheet" << endl; system("PAUSE"); continue; }
+		if (All_Sheets[sheet_id].fake) cc.fake = true;
+		sheet_ids.push_back(sheet_id);
 	}
 
 	return true;
@@ -545,7 +520,7 @@ void simplification::sheet_chord_weight(Tuple_Candidate &c){
 			for (uint32_t k = 0; k<frame.FEs[fe].es_link.size(); k++){
 				uint32_t eid = frame.FEs[fe].es_link[k];
 				uint32_t v0 = mesh.Es[eid].vs[0], v1 = mesh.Es[eid].vs[1];
-				cur_len += (mesh.V.col(v0) - mesh.V.col(v1)).norm();
+				cur_len += (mesh.V.col(v0).cast<double>() - mesh.V.col(v1).cast<double>()).norm();
 			}
 			edge_len += cur_len;
 		}
@@ -560,7 +535,7 @@ void simplification::sheet_chord_weight(Tuple_Candidate &c){
 		for (auto fid : All_Sheets[id].middle_fs) {
 			for (uint32_t i = 0; i < 2; i++) {
 				uint32_t eid = frame.FFs[fid].es[i];
-				if (find(All_Sheets[id].middle_es.begin(), All_Sheets[id].middle_es.end(), eid) == All_Sheets[id].middle_es.end()) {
+				if (FE_sheet[eid] != id) {
 					uint32_t eid1 = frame.FFs[fid].es[(i + 2) % 4];
 					Es_neighborhood[eid].push_back(eid1);
 					Es_neighborhood[eid1].push_back(eid);
@@ -623,7 +598,7 @@ void simplification::sheet_chord_weight(Tuple_Candidate &c){
 				v0 = frame.FVs[cc.parallel_ns[0][i]].hid;
 				v1 = frame.FVs[cc.parallel_ns[2][i]].hid;
 			}
-			vv0 = mesh.V.col(v0); vv1 = mesh.V.col(v1);
+			vv0 = mesh.V.col(v0).cast<double>(); vv1 = mesh.V.col(v1).cast<double>();
 			diagonal_len += (vv0 - vv1).norm();
 		}
 		diagonal_len *= 1.0 / cc.parallel_ns[0].size();		
@@ -762,11 +737,11 @@ void simplification::dihedral_angle(Float &angle, Float &k_ratio, vector<uint32_
 		uint32_t hv3 = frame.FVs[v3].hid;
 		uint32_t hv4 = frame.FVs[v4].hid;
 		Vector3d dir1, dir2, norm1, norm2;
-		dir1 = mesh.V.col(hv3) - mesh.V.col(hv1);
-		dir2 = mesh.V.col(hv3) - mesh.V.col(hv2);
+		dir1 = mesh.V.col(hv3).cast<double>() - mesh.V.col(hv1).cast<double>();
+		dir2 = mesh.V.col(hv3).cast<double>() - mesh.V.col(hv2).cast<double>();
 		norm1 = dir1.cross(dir2); norm1.normalize();
-		dir1 = mesh.V.col(hv4) - mesh.V.col(hv1);
-		dir2 = mesh.V.col(hv4) - mesh.V.col(hv2);
+		dir1 = mesh.V.col(hv4).cast<double>() - mesh.V.col(hv1).cast<double>();
+		dir2 = mesh.V.col(hv4).cast<double>() - mesh.V.col(hv2).cast<double>();
 		norm2 = dir1.cross(dir2); norm2.normalize();
 		angles.push_back(PAI - std::acos(norm1.dot(norm2)));
 	}
@@ -786,27 +761,22 @@ bool simplification::remove() {
 	for (uint32_t i = 0; i < Candidates.size(); i++) {
 		uint32_t id = i;
 		File_num = id;
-		if (!filter_topology_feature(Candidates[id])) continue;
-		uint32_t feid;
-		if (std::get<1>(Candidates[id]) == Base_Set::SHEET) {
-			uint32_t sheet_id = std::get<0>(Candidates[id]);
-			feid = All_Sheets[sheet_id].middle_es[0];
+		if (!time_for(candidate_ms + update_ms)) {
+			cout << "deadline: no time for another candidate" << endl; return false;
 		}
-		else if (std::get<1>(Candidates[id]) == Base_Set::CHORD) {
-			uint32_t chord_id = std::get<0>(Candidates[id]);
-			feid = All_Chords[chord_id].parallel_es[0][0];
+		Timer<> candidate_timer;
+		//a slow candidate raises the estimate at once, fast ones lower it gradually
+		auto candidate_done = [&]() { candidate_ms = std::max((double)candidate_timer.value(), 0.8 * candidate_ms); };
+		uint64_t key;
+		if (!filter_topology_feature(Candidates[id], key)) {
+			candidate_done(); continue;
 		}
+		candidate_parameters(Candidates[id]);
 
-		Float resolution = frame.FEs[feid].es_link.size();
-		Projection_range = resolution + 1;
-		Slim_Iteration = resolution * Slim_Iteration_base;
-		if (Slim_Iteration > Slim_Iteration_Limit) Slim_Iteration = Slim_Iteration_Limit;
-
-		if (Projection_range > Projection_limit)Projection_range = Projection_limit;
-
-		width_sheet = resolution;
-
-		if (!direct_collapse()) continue;
+		if (!direct_collapse()) {
+			Rejected.insert(key); candidate_done(); continue;
+		}
+		candidate_done();
 
 		if (id >= Candidates.size() - last_candidate_pos)
 			last_candidate_pos = id - Candidates.size() + last_candidate_pos;
@@ -820,23 +790,78 @@ bool simplification::remove() {
 	cout << "cannot find candidate anymore" << endl;
 	return false;
 }
-bool simplification::filter_topology_feature(Tuple_Candidate &c) {
-	if (!TOPOLOGY && !SHARP_FEATURE) return true;
-	uint32_t id = get<0>(c);
-	if (get<1>(c) == Base_Set::SHEET) {
-		if (All_Sheets[id].valence_filter) {
-			return false;}
-		if (All_Sheets[id].fake) {
-			return false;}
-		vector<vector<uint32_t>> candiate_es_links, v_group;
-		if (!vs_pair_sheet(id, candiate_es_links, v_group)) { cout << "ERROR: no vs pairs" << endl;  system("PAUSE");}
-		if (!target_surface_sheet(id, candiate_es_links, v_group)) {
+bool simplification::filter_topology_feature(Tuple_Candidate &c, uint64_t &key) {
+	if (!TOPOLOGY && !SHARP_FEATURE) return !rejected_before(c, key);
+	return filter_cascade(c, true, key);
+}
+bool simplification::filter_feature(Tuple_Candidate &c, uint64_t &key) {
+	return filter_cascade(c, false, key);
+}
+bool simplification::rejected_before(Tuple_Candidate &c, uint64_t &key) {
+	key = candidate_signature(c);
+	if (!Rejected.count(key)) return false;
+	rejected_skips++;
+	return true;
+}
+bool simplification::filter_cascade(Tuple_Candidate &c, bool topology, uint64_t &key) {
+	//a stage runs once its inputs exist: structure before groups, groups before targets, targets before the jacobian check;
+	//topology collapses the mesh and goes last, nothing may reject after it
+	static const uint32_t all = (1 << FILTER_NUM) - 1;
+	static const uint32_t inputs[FILTER_NUM] = { 0, 0, 1 << STRUCTURE_FILTER, 1 << GROUP_FILTER, 1 << FEATURE_FILTER, all & ~(1 << TOPOLOGY_FILTER) };
+	uint32_t todo = all;
+	if (!topology) todo &= ~(1 << TOPOLOGY_FILTER);
+	if (Predict_Jacobian_Bound <= -1) todo &= ~(1 << JACOBIAN_FILTER);
+	//the signature is a region bfs, the rejected cache is consulted once the cheap stages passed
+	static const uint32_t cheap = (1 << STRUCTURE_FILTER) | (1 << BOUNDARY_FILTER);
+	bool keyed = false;
+	//skipped stages count as done
+	uint32_t done = all & ~todo;
+	while (todo) {
+		if (!keyed && (done & cheap) == cheap) {
+			if (rejected_before(c, key)) return false;
+			keyed = true;
+		}
+		int next = -1;
+		double best = 0;
+		for (int s = 0; s < FILTER_NUM; s++) {
+			if (!(todo & (1 << s)) || (inputs[s] & ~done)) continue;
+			if (!keyed && !(cheap & (1 << s))) continue;
+			if (!Filter_Adaptive) { next = s; break; }
+			//expected time spent per rejection, smoothed for unseen stages
+			Filter_Counter &cnt = filter_counters[s];
+			double cost = (cnt.ms + 1.e-3) / (cnt.calls + 1), rate = (cnt.rejects + 1.0) / (cnt.calls + 2);
+			if (next == -1 || cost / rate < best) { next = s; best = cost / rate; }
+		}
+		Filter_Counter &cnt = filter_counters[next];
+		Timer<std::chrono::microseconds> timer;
+		bool pass = filter_stage((Filter_Stage)next, c);
+		cnt.calls++; cnt.ms += timer.value() / 1000.0;
+		if (!pass) {
+			cnt.rejects++;
+			if (journal.active) rollback_collapse();
+			if (keyed) Rejected.insert(key);
 			return false;
 		}
-
-		if (TOPOLOGY) {
-			vector<bool> F_flag(frame.FFs.size(), false);
-			for (auto fid : All_Sheets[id].middle_fs) F_flag[fid] = true;
+		done |= 1 << next; todo &= ~(1 << next);
+	}
+	if (!keyed) return !rejected_before(c, key);
+	return true;
+}
+bool simplification::filter_stage(Filter_Stage s, Tuple_Candidate &c) {
+	uint32_t id = get<0>(c);
+	bool sheet = get<1>(c) == Base_Set::SHEET;
+	switch (s) {
+	case STRUCTURE_FILTER:
+		if (sheet) return !All_Sheets[id].valence_filter && !All_Sheets[id].fake;
+		if (All_Chords[id].type != Sheet_type::close && All_Chords[id].type != Sheet_type::open) return false;
+		if (All_Chords[id].valence_filter || All_Chords[id].weight_val_min < 3.0 || All_Chords[id].weight_val_max > 5.0) return false;
+		return !All_Chords[id].fake;
+	case BOUNDARY_FILTER:
+		if (!sheet || !TOPOLOGY) return true;
+		{
+			Scratch_Scope scope(pool);
+			Epoch_Flags &F_flag = pool.flag(frame.FFs.size());
+			for (auto fid : All_Sheets[id].middle_fs) F_flag.set(fid);
 			for (auto cid : All_Sheets[id].cs) {
 				vector<uint32_t> side_fs;
 				for (auto fid : frame.FHs[cid].fs) if (!F_flag[fid]) side_fs.push_back(fid);
@@ -845,24 +870,52 @@ bool simplification::filter_topology_feature(Tuple_Candidate &c) {
 				}
 			}
 		}
+		return true;
+	case GROUP_FILTER:
+		if (!sheet) return vs_group_chord(id);
+		sheet_es_links.clear(); sheet_v_group.clear();
+		if (!vs_pair_sheet(id, sheet_es_links, sheet_v_group)) { cout << "ERROR: no vs pairs" << endl;  system("PAUSE");}
+		return true;
+	case FEATURE_FILTER:
+		if (sheet) return target_surface_sheet(id, sheet_es_links, sheet_v_group);
+		return target_surface_chord(id);
+	case JACOBIAN_FILTER:
+		return predict_jacobian();
+	case TOPOLOGY_FILTER:
+		return topology_check();
+	default:
+		return true;
 	}
-	else if (get<1>(c) == Base_Set::CHORD) {
-		if (All_Chords[id].type != Sheet_type::close && All_Chords[id].type != Sheet_type::open) return false;
-		if (All_Chords[id].valence_filter || All_Chords[id].weight_val_min < 3.0 || All_Chords[id].weight_val_max > 5.0) return false;
-
-		if (All_Chords[id].fake ) {
-			return false;
-		}
-		if (!vs_group_chord(id)) return false;
-		if (!target_surface_chord(id)) return false;
-	}
-
-	if (!topology_check()) {
-		return false;
+}
+bool simplification::predict_jacobian() {
+	//hexes around the groups with every group snapped onto its target
+	Scratch_Scope scope(pool);
+	Epoch_Flags &H_flag = pool.flag(mesh.Hs.size());
+	std::unordered_map<uint32_t, uint32_t> V_group;
+	for (uint32_t i = 0; i < CI.V_Groups.size(); i++) for (auto vid : CI.V_Groups[i]) V_group[vid] = i;
+	for (auto hid : CI.hs) H_flag.set(hid);
+	Vector3d cs[8];
+	for (auto &vs : CI.V_Groups) for (auto vid : vs) for (auto hid : mesh.Vs[vid].neighbor_hs) {
+		if (H_flag[hid]) continue;
+		H_flag.set(hid);
+		for (uint32_t j = 0; j < 8; j++) {
+			uint32_t hvid = mesh.Hs[hid].vs[j];
+			auto it = V_group.find(hvid);
+			if (it != V_group.end()) cs[j] = CI.target_coords.row(it->second).transpose();
+			else cs[j] = mesh.V.col(hvid).cast<double>();
+		}
+		if (hex_scaled_jacobian(cs) < Predict_Jacobian_Bound) return false;
 	}
-
 	return true;
 }
+void simplification::filter_report() {
+	static const char *names[FILTER_NUM] = { "structure", "boundary", "groups", "feature", "jacobian", "topology" };
+	cout << "filter: calls rejects ms" << endl;
+	for (uint32_t s = 0; s < FILTER_NUM; s++) {
+		Filter_Counter &cnt = filter_counters[s];
+		if (cnt.calls) cout << "  " << names[s] << ": " << cnt.calls << " " << cnt.rejects << " " << cnt.ms << endl;
+	}
+}
 bool simplification::vs_pair_sheet(uint32_t sheet_id, vector<vector<uint32_t>> &candiate_es_links, vector<vector<uint32_t>> &v_group) {
 	if (sheet_id >= All_Sheets.size()) return false;
 	
@@ -870,7 +923,8 @@ bool simplification::vs_pair_sheet(uint32_t sheet_id, vector<vector<uint32_t>> &
 	for (uint32_t i = 0; i < All_Sheets[sheet_id].middle_es.size(); i++)
 		es_links[i] = frame.FEs[All_Sheets[sheet_id].middle_es[i]].es_link;
 
-	vector<bool> e_flag(mesh.Es.size(), false);
+	Scratch_Scope scope(pool);
+	Epoch_Flags &e_flag = pool.flag(mesh.Es.size());
 	vector<uint32_t> v_pair(2);
 	while (true) {
 		for (uint32_t i = 0; i<es_links.size(); i++) {
@@ -901,17 +955,12 @@ bool simplification::vs_pair_sheet(uint32_t sheet_id, vector<vector<uint32_t>> &
 			v_pair[1] = v2;
 			v_group.push_back(v_pair);
 
-			for (uint32_t j = 0; j<es_links[i].size(); j++) e_flag[es_links[i][j]] = true;
+			for (uint32_t j = 0; j<es_links[i].size(); j++) e_flag.set(es_links[i][j]);
 
 
 			for (uint32_t j = 0; j<mesh.Es[es_links[i][0]].neighbor_fs.size(); j++) {
 				uint32_t nf = mesh.Es[es_links[i][0]].neighbor_fs[j];
-				uint32_t op_eid = INVALID_E;
-				for (uint32_t k = 0; k<4; k++) {
-					if (mesh.Fs[nf].es[k] == es_links[i][0]) {
-						op_eid = mesh.Fs[nf].es[(k + 2) % 4]; break;
-					}
-				}
+				uint32_t op_eid = quad_opposite_e(mesh.Fs[nf].es, es_links[i][0]);
 				if (op_eid == INVALID_E) { 
 					cout << "error " << endl; system("PAUSE"); 
 				}
@@ -922,33 +971,15 @@ bool simplification::vs_pair_sheet(uint32_t sheet_id, vector<vector<uint32_t>> &
 				es_link.push_back(op_eid);
 
 				for (uint32_t k = 1; k<es_links[i].size(); k++) {
-					for (uint32_t m = 0; m<mesh.Es[es_links[i][k]].neighbor_fs.size(); m++) {
-						uint32_t n_f = mesh.Es[es_links[i][k]].neighbor_fs[m];
-						bool havesharede = false;
-						for (uint32_t p = 0; p<4; p++) {
-							for (uint32_t q = 0; q<4; q++) {
-								if (mesh.Fs[n_f].es[p] == mesh.Fs[pre_nf].es[q]) {
-									havesharede = true; break;
-								}
-							}
-							if (havesharede) break;
-						}
-						if (havesharede) {
-							pre_nf = n_f;
-							op_eid = INVALID_E;
-							for (uint32_t p = 0; p<4; p++) {
-								if (mesh.Fs[n_f].es[p] == es_links[i][k])
-								{
-									op_eid = mesh.Fs[n_f].es[(p + 2) % 4]; break;
-								}
-							}
-							if (op_eid == INVALID_E) {
-								cout << "error " << endl; system("PAUSE"); 
-							}
-							es_link.push_back(op_eid);
-							break;
-						}
+					//walk the edge ring: next quad along the chain, then across it
+					uint32_t n_f = strip_next_f(mesh, pre_nf, es_links[i][k - 1], es_links[i][k]);
+					if (n_f == INVALID_E) continue;
+					pre_nf = n_f;
+					op_eid = quad_opposite_e(mesh.Fs[n_f].es, es_links[i][k]);
+					if (op_eid == INVALID_E) {
+						cout << "error " << endl; system("PAUSE"); 
 					}
+					es_link.push_back(op_eid);
 				}
 				es_links_temp.push_back(es_link);
 			}
@@ -979,28 +1010,29 @@ bool simplification::target_surface_sheet(uint32_t sheet_id, vector<vector<uint3
 		}
 		vs_links_temp[i] = vs_link;
 	}
-	vector<bool> V_flag(mesh.Vs.size(), true);
-	for (auto v_link : vs_links_temp)for (uint32_t j = 1; j < v_link.size() - 1; j++) V_flag[v_link[j]] = false;
+	Scratch_Scope scope(pool);
+	Epoch_Flags &Inner_flag = pool.flag(mesh.Vs.size());
+	for (auto &v_link : vs_links_temp)for (uint32_t j = 1; j < v_link.size() - 1; j++) Inner_flag.set(v_link[j]);
 
 	vector<vector<uint32_t>> &vs_pairs = All_Sheets[sheet_id].vs_pairs,
 							 &vs_links = All_Sheets[sheet_id].vs_links;
 	vs_pairs.clear(); vs_links.clear();
 	for (uint32_t i = 0; i < v_group.size();i++) {
 		vector<uint32_t> &a_pair = v_group[i];
-		if (!V_flag[a_pair[0]] && !V_flag[a_pair[1]]) continue;
+		if (Inner_flag[a_pair[0]] && Inner_flag[a_pair[1]]) continue;
 		vs_pairs.push_back(a_pair);
 		vs_links.push_back(vs_links_temp[i]);
 	}
 	//grouping
 	vector<vector<uint32_t>> &Vs_Group = All_Sheets[sheet_id].Vs_Group;
 	Vs_Group.clear();
-	vector<bool> v_flag(mesh.Vs.size(), false);
-	vector<vector<uint32_t>> v_nvs(mesh.Vs.size());
-	for (auto a_pair: vs_pairs) {
-		v_nvs[a_pair[0]].push_back(a_pair[1]);
-		v_nvs[a_pair[1]].push_back(a_pair[0]);
-		v_flag[a_pair[0]] = true;
-		v_flag[a_pair[1]] = true;
+	Epoch_Flags &v_flag = pool.flag(mesh.Vs.size());
+	Sparse_Lists &v_nvs = pool.list(mesh.Vs.size());
+	for (auto &a_pair: vs_pairs) {
+		v_nvs.add(a_pair[0], a_pair[1]);
+		v_nvs.add(a_pair[1], a_pair[0]);
+		v_flag.set(a_pair[0]);
+		v_flag.set(a_pair[1]);
 	}
 	while (true) {
 		vector<uint32_t> a_set, a_pool;
@@ -1010,13 +1042,13 @@ bool simplification::target_surface_sheet(uint32_t sheet_id, vector<vector<uint3
 		}
 		if (!a_pool.size()) break;
 		a_set = a_pool;
-		v_flag[a_pool[0]] = false;
+		v_flag.unset(a_pool[0]);
 		while (a_pool.size()) {
 			vector<uint32_t> a_pool_sudo;
 			for (auto vid0: a_pool)
 				for (auto vid0_: v_nvs[vid0])
 					if (v_flag[vid0_]) {
-						a_pool_sudo.push_back(vid0_); v_flag[vid0_] = false;
+						a_pool_sudo.push_back(vid0_); v_flag.unset(vid0_);
 					}
 			a_pool.clear();
 			if (a_pool_sudo.size()) {
@@ -1035,11 +1067,11 @@ bool simplification::target_surface_sheet(uint32_t sheet_id, vector<vector<uint3
 	All_Sheets[sheet_id].target_vs.resize(Vs_Group.size());
 	All_Sheets[sheet_id].target_coords.resize(Vs_Group.size(), 3);
 
-	vector<bool> b_tags(mesh.Vs.size(),false);
+	Epoch_Flags &b_tags = pool.flag(mesh.Vs.size());
 	for (auto ffid:All_Sheets[sheet_id].side_fs){
 		if (!frame.FFs[ffid].boundary) continue;
 		for (auto hfid : frame.FFs[ffid].ffs_net)
-			for (auto hvid : mesh.Fs[hfid].vs) b_tags[hvid] = true;
+			for (auto hvid : mesh.Fs[hfid].vs) b_tags.set(hvid);
 	}
 
 	bool multiple_corners = false, multiple_curves = false, corner_curve_conflict = false, multiple_boundaries = false, corner_boundary_conflict = false;
@@ -1057,7 +1089,7 @@ bool simplification::target_surface_sheet(uint32_t sheet_id, vector<vector<uint3
 			on_boundary = true;
 			b_count++;
 		}
-		if(on_boundary) All_Sheets[sheet_id].target_coords.row(i) = mesh.V.col(Id);
+		if(on_boundary) All_Sheets[sheet_id].target_coords.row(i) = mesh.V.col(Id).cast<double>();
 		if (b_count > 1) multiple_boundaries = true;
 		//vs_links_group
 		vector<vector<uint32_t>> vs_links_group;
@@ -1089,7 +1121,7 @@ bool simplification::target_surface_sheet(uint32_t sheet_id, vector<vector<uint3
 			if (coner_ids.size()) {
 				if (coner_ids.size()> 1) multiple_corners = true;
 				Id = coner_ids[0];
-				All_Sheets[sheet_id].target_coords.row(i) = mesh.V.col(Id);
+				All_Sheets[sheet_id].target_coords.row(i) = mesh.V.col(Id).cast<double>();
 
 				if (curves.size() > 1) multiple_curves = true;
 				else if (curves.size() == 1) {
@@ -1101,7 +1133,7 @@ bool simplification::target_surface_sheet(uint32_t sheet_id, vector<vector<uint3
 			else  if (vs_type1.size()) {
 				if (curves.size() > 1) multiple_curves = true;
 				Vector3d coords(0, 0, 0);
-				for (auto vid : vs_type1) coords += mesh.V.col(vid);
+				for (auto vid : vs_type1) coords += mesh.V.col(vid).cast<double>();
 				coords /= vs_type1.size();
 				All_Sheets[sheet_id].target_coords.row(i) = coords;
 				Id = vs_type1[0];
@@ -1118,12 +1150,12 @@ bool simplification::target_surface_sheet(uint32_t sheet_id, vector<vector<uint3
 			if (coner_ids.size()) {
 				if (coner_ids.size()> 1) multiple_corners = true;
 				Id = coner_ids[0];
-				All_Sheets[sheet_id].target_coords.row(i) = mesh.V.col(Id);
+				All_Sheets[sheet_id].target_coords.row(i) = mesh.V.col(Id).cast<double>();
 			}
 			else  if (vs_type1.size()) {
 				if (curves.size() > 1) multiple_curves = true;
 				Vector3d coords(0, 0, 0);
-				for (auto vid : vs_type1) coords += mesh.V.col(vid);
+				for (auto vid : vs_type1) coords += mesh.V.col(vid).cast<double>();
 				coords /= vs_type1.size();
 				All_Sheets[sheet_id].target_coords.row(i) = coords;
 				Id = vs_type1[0];
@@ -1135,12 +1167,12 @@ bool simplification::target_surface_sheet(uint32_t sheet_id, vector<vector<uint3
 			Vector3d coords(0, 0, 0);
 			for (auto a_link : vs_links_group) {
 				Id = a_link[a_link.size() / 2];
-				if(a_link.size() ==2) coords +=(mesh.V.col(a_link[0]) + mesh.V.col(a_link[1])) / 2;
+				if(a_link.size() ==2) coords +=(mesh.V.col(a_link[0]).cast<double>() + mesh.V.col(a_link[1]).cast<double>()) / 2;
 				else if (a_link.size() % 2 == 0) {
-					coords += (mesh.V.col(a_link[a_link.size() / 2 - 1]) + mesh.V.col(Id)) * 0.5;
+					coords += (mesh.V.col(a_link[a_link.size() / 2 - 1]).cast<double>() + mesh.V.col(Id).cast<double>()) * 0.5;
 				}
 				else if (a_link.size() % 2 == 1) {
-					coords += mesh.V.col(Id);
+					coords += mesh.V.col(Id).cast<double>();
 				}
 			}
 			coords /= vs_links_group.size();
@@ -1177,15 +1209,15 @@ bool simplification::vs_group_chord(uint32_t chord_id) {
 		else {
 			a_chain.push_back(links[i][j]);
 			for (uint32_t k = 1; k<vs_chains[i][j-1].size(); k++){
-				uint32_t v0 = vs_chains[i][j-1][k-1], v1 = vs_chains[i][j - 1][k], v2 = a_chain[k-1], v3;
-				sort(mesh.Vs[v0].neighbor_fs.begin(), mesh.Vs[v0].neighbor_fs.end());
-				sort(mesh.Vs[v1].neighbor_fs.begin(), mesh.Vs[v1].neighbor_fs.end());
-				sort(mesh.Vs[v2].neighbor_fs.begin(), mesh.Vs[v2].neighbor_fs.end());
-				vector<uint32_t> sharedf0, sharedf1;
-				set_intersection(mesh.Vs[v0].neighbor_fs.begin(), mesh.Vs[v0].neighbor_fs.end(),
-					mesh.Vs[v1].neighbor_fs.begin(), mesh.Vs[v1].neighbor_fs.end(), back_inserter(sharedf0));
-				set_intersection(sharedf0.begin(), sharedf0.end(), mesh.Vs[v2].neighbor_fs.begin(), mesh.Vs[v2].neighbor_fs.end(), back_inserter(sharedf1));
-				for (auto vid : mesh.Fs[sharedf1[0]].vs) if (vid != v0 &&vid != v1 &&vid != v2) {v3 = vid; break;}
+				uint32_t v0 = vs_chains[i][j-1][k-1], v1 = vs_chains[i][j - 1][k], v2 = a_chain[k-1], v3 = INVALID_V;
+				//the quad spanned by edges v0-v1 and v0-v2
+				uint32_t e01 = vs_lookup(mesh.E_index, vs_key(v0, v1)), e02 = vs_lookup(mesh.E_index, vs_key(v0, v2));
+				uint32_t sharedf = INVALID_E;
+				if (e01 != INVALID_E && e02 != INVALID_E)
+					for (auto nfid : mesh.Es[e01].neighbor_fs)
+						if (find(mesh.Es[e02].neighbor_fs.begin(), mesh.Es[e02].neighbor_fs.end(), nfid) != mesh.Es[e02].neighbor_fs.end()) { sharedf = nfid; break; }
+				if (sharedf == INVALID_E) { cout << "ERROR: no shared face" << endl; system("PAUSE"); return false; }
+				for (auto vid : mesh.Fs[sharedf].vs) if (vid != v0 &&vid != v1 &&vid != v2) {v3 = vid; break;}
 				a_chain.push_back(v3);
 			}
 		}
@@ -1255,12 +1287,8 @@ bool simplification::vs_group_chord(uint32_t chord_id) {
 	}
 	vector<vector<uint32_t>> vs_pairs, vs_links_cut;
 	if (longer) {
-		uint32_t sheet_id = -1;
-		for (auto sheet : All_Sheets)
-			if (find(sheet.middle_es.begin(), sheet.middle_es.end(), feid) != sheet.middle_es.end()) {
-				sheet_id = sheet.id; break;
-			}
-		if (sheet_id == -1) { cout << "doesnot find the longer sheet" << endl; system("PAUSE"); }
+		uint32_t sheet_id = FE_sheet[feid];
+		if (sheet_id == INVALID_E) { cout << "doesnot find the longer sheet" << endl; system("PAUSE"); }
 		if (All_Sheets[sheet_id].type != Sheet_type::close && All_Sheets[sheet_id].type != Sheet_type::open) {
 			return false;
 		}
@@ -1408,7 +1436,7 @@ bool simplification::target_surface_chord(uint32_t chord_id) {
 			on_boundary = true;
 			b_count++;
 		}
-		if (on_boundary) CI.target_coords.row(i) = mesh.V.col(Id);
+		if (on_boundary) CI.target_coords.row(i) = mesh.V.col(Id).cast<double>();
 		if (b_count > 1) multiple_boundaries = true;
 		//if on feature line/corner
 		vector<uint32_t> coner_ids, corner;
@@ -1430,7 +1458,7 @@ bool simplification::target_surface_chord(uint32_t chord_id) {
 			if (coner_ids.size()) {
 				if (coner_ids.size()> 1) multiple_corners = true;
 				Id = coner_ids[0];
-				CI.target_coords.row(i) = mesh.V.col(Id);
+				CI.target_coords.row(i) = mesh.V.col(Id).cast<double>();
 
 				if (curves.size() > 1) multiple_curves = true;
 				else if (curves.size() == 1) {
@@ -1442,7 +1470,7 @@ bool simplification::target_surface_chord(uint32_t chord_id) {
 			else  if (vs_type1.size()) {
 				if (curves.size() > 1) multiple_curves = true;
 				Vector3d coords(0, 0, 0);
-				for (auto vid : vs_type1) coords += mesh.V.col(vid);
+				for (auto vid : vs_type1) coords += mesh.V.col(vid).cast<double>();
 				coords /= vs_type1.size();
 				CI.target_coords.row(i) = coords;
 				Id = vs_type1[0];
@@ -1458,12 +1486,12 @@ bool simplification::target_surface_chord(uint32_t chord_id) {
 			if (coner_ids.size()) {
 				if (coner_ids.size()> 1) multiple_corners = true;
 				Id = coner_ids[0];
-				CI.target_coords.row(i) = mesh.V.col(Id);
+				CI.target_coords.row(i) = mesh.V.col(Id).cast<double>();
 			}
 			else  if (vs_type1.size()) {
 				if (curves.size() > 1) multiple_curves = true;
 				Vector3d coords(0, 0, 0);
-				for (auto vid : vs_type1) coords += mesh.V.col(vid);
+				for (auto vid : vs_type1) coords += mesh.V.col(vid).cast<double>();
 				coords /= vs_type1.size();
 				CI.target_coords.row(i) = coords;
 				Id = vs_type1[0];
@@ -1474,7 +1502,7 @@ bool simplification::target_surface_chord(uint32_t chord_id) {
 		if (!on_boundary && !on_feature) {
 			Vector3d coords(0, 0, 0);
 			Id = a_group[0];
-			for (auto vid : a_group) coords += mesh.V.col(vid);
+			for (auto vid : a_group) coords += mesh.V.col(vid).cast<double>();
 			coords /= a_group.size();
 			CI.target_coords.row(i) = coords;
 		}
@@ -1484,65 +1512,130 @@ bool simplification::target_surface_chord(uint32_t chord_id) {
 	return true;
 }
 bool simplification::topology_check() {
-	
-	mesh_.type = Mesh_type::Hex;
-	auto &Vs_Group = CI.V_Groups;
-	vector<bool> V_flag(mesh.Vs.size(), false), H_flag(mesh.Hs.size(), false);
+	if (!apply_collapse()) return false;
 
-	for (auto hid : CI.hs) {
-		H_flag[hid] = true;
-		for (uint32_t i = 0; i < 8; i++) V_flag[mesh.Hs[hid].vs[i]] = true;
-	}
-	//V_map, RV_map
-	V_map.resize(mesh.Vs.size()); fill(V_map.begin(), V_map.end(), INVALID_V);
-	vector<uint32_t>().swap(RV_map);
+	Mesh_Topology mt_;
+	topology_info(mesh, frame_, mt_);
+	if (!comp_topology(mt, mt_)) { rollback_collapse(); return false; }
+	return true;
+}
+bool simplification::apply_collapse() {
+	if (journal.active) rollback_collapse();
+	//the constrained smoothing runs on the pre-collapse mesh: tetralize and keep its region hexes first
+	tetralize_mesh(ts);
+	CI.region_hs.resize(CI.Hsregion.size()); CI.region_ids.resize(CI.Hsregion.size());
+	for (uint32_t i = 0; i < CI.Hsregion.size(); i++) { CI.region_hs[i] = mesh.Hs[CI.Hsregion[i]]; CI.region_ids[i] = i; }
 
-	for (auto vs : Vs_Group) for (auto vid : vs) V_flag[vid] = true;
-	for (uint32_t i = 0; i < Vs_Group.size(); i++) V_flag[CI.target_vs[i]] = false;
-	uint32_t V_num = 0;
-	for (uint32_t i = 0; i < V_flag.size(); i++) if (!V_flag[i]) { V_map[i] = V_num++; RV_map.push_back(i); }
+	auto &Vs_Group = CI.V_Groups;
+	Collapse_Journal &J = journal;
+	J.V_num = mesh.Vs.size(); J.H_num = mesh.Hs.size();
+
+	Scratch_Scope scope(pool);
+	Epoch_Flags &D_flag = pool.flag(J.V_num), &R_flag = pool.flag(J.H_num), &A_flag = pool.flag(J.H_num);
+	//removed hexes, deleted vertices
+	vector<uint32_t> Rs, Ds;
+	for (auto hid : CI.hs) if (!R_flag[hid]) { R_flag.set(hid); Rs.push_back(hid); }
+	for (auto hid : Rs) for (auto vid : mesh.Hs[hid].vs) if (!D_flag[vid]) { D_flag.set(vid); Ds.push_back(vid); }
+	for (auto &vs : Vs_Group) for (auto vid : vs) if (!D_flag[vid]) { D_flag.set(vid); Ds.push_back(vid); }
+	for (uint32_t i = 0; i < Vs_Group.size(); i++) D_flag.unset(CI.target_vs[i]);
+	Ds.erase(remove_if(Ds.begin(), Ds.end(), [&](uint32_t vid) { return !D_flag[vid]; }), Ds.end());
+	sort(Ds.begin(), Ds.end()); sort(Rs.begin(), Rs.end());
+	//V_map: survivors keep their slot unless they fill a hole, group members follow their target
+	uint32_t V_num = J.V_num - Ds.size();
+	V_map.resize(J.V_num);
+	for (uint32_t i = 0; i < J.V_num; i++) V_map[i] = i;
+	for (auto vid : Ds) V_map[vid] = INVALID_V;
+	uint32_t mover = V_num;
+	for (auto vid : Ds) {
+		if (vid >= V_num) break;
+		while (D_flag[mover]) mover++;
+		J.vs_moved.push_back(make_pair(vid, mover)); V_map[mover] = vid; mover++;
+	}
 	for (uint32_t i = 0; i < Vs_Group.size(); i++) {
 		uint32_t mid = V_map[CI.target_vs[i]];
-		for (auto vid : Vs_Group[i])V_map[vid] = mid;
+		for (auto vid : Vs_Group[i]) V_map[vid] = mid;
 	}
-	//Vs
-	vector<Hybrid_V>().swap(mesh_.Vs);
-	mesh_.V.resize(3, V_num); mesh_.V.setZero();
-	mesh_.Vs.resize(V_num);
-	for (uint32_t i = 0; i<V_num; i++){
-		Hybrid_V v;
-		v.id = i; v.boundary = false;
-		mesh_.Vs[i] = v;
-	}
-	for (uint32_t i = 0; i < V_flag.size(); i++) if (!V_flag[i]) mesh_.V.col(V_map[i]) = mesh.V.col(i);
-	for (uint32_t i = 0; i < CI.target_vs.rows(); i++) mesh_.V.col(V_map[CI.target_vs[i]]) = CI.target_coords.row(i);
-
-	//Hs
-	uint32_t H_num = 0;
-	for (auto h_flag : H_flag) if (!h_flag) H_num++;
-
-	vector<Hybrid>().swap(mesh_.Hs);
-
-	mesh_.Hs.resize(H_num); H_num = 0;
-	Hybrid h_; h_.vs.resize(8);
-	for (auto h : mesh.Hs) if (!H_flag[h.id]) {
-		h_.id= H_num++;
-		for (uint32_t i = 0; i < 8; i++) h_.vs[i] = V_map[h.vs[i]];
-		mesh_.Hs[h_.id] = h_;
-		for (uint32_t i = 0; i < h_.vs.size(); i++) mesh_.Vs[h_.vs[i]].neighbor_hs.push_back(h_.id);
-	}
-	
-	build_connectivity(mesh_);
-	base_com.singularity_structure(si_, mesh_);
-	if(!base_com.base_complex_extraction(si_, frame_, mesh_)) return false;
+	//remap the surviving hexes around deleted or moved vertices
+	auto remap_hs = [&](uint32_t vid) {
+		for (auto hid : mesh.Vs[vid].neighbor_hs) if (!R_flag[hid] && !A_flag[hid]) {
+			A_flag.set(hid);
+			J.hs_vs.push_back(make_pair(hid, mesh.Hs[hid].vs));
+			for (auto &hvid : mesh.Hs[hid].vs) hvid = V_map[hvid];
+		}
+	};
+	for (auto vid : Ds) remap_hs(vid);
+	for (auto &m : J.vs_moved) remap_hs(m.second);
+	//coordinates
+	for (auto vid : Ds) J.coords.push_back(make_pair(vid, Vector3F(mesh.V.col(vid))));
+	for (uint32_t i = 0; i < Vs_Group.size(); i++) {
+		uint32_t tid = CI.target_vs[i];
+		J.coords.push_back(make_pair(tid, Vector3F(mesh.V.col(tid))));
+		mesh.V.col(tid) = CI.target_coords.row(i).transpose().cast<Float>();
+	}
+	for (auto &m : J.vs_moved) mesh.V.col(m.first) = mesh.V.col(m.second);
+	mesh.V.conservativeResize(3, V_num);
+	//hexes: fill the holes from the tail
+	uint32_t H_num = J.H_num - Rs.size(), hmover = H_num;
+	for (auto hid : Rs) {
+		J.hs_removed.push_back(make_pair(hid, std::move(mesh.Hs[hid])));
+		if (hid >= H_num) continue;
+		while (R_flag[hmover]) hmover++;
+		mesh.Hs[hid] = std::move(mesh.Hs[hmover]); mesh.Hs[hid].id = hid;
+		J.hs_moved.push_back(make_pair(hid, hmover)); hmover++;
+	}
+	mesh.Hs.resize(H_num);
+	//connectivity of the collapsed mesh, the old one is kept aside
+	J.Vs.swap(mesh.Vs); J.Es.swap(mesh.Es); J.Fs.swap(mesh.Fs);
+	J.E_index.swap(mesh.E_index); J.F_index.swap(mesh.F_index);
+	//edges are renumbered: hex es are left empty and refilled on demand
+	J.hs_fs.resize(H_num); J.hs_es.resize(H_num);
+	for (uint32_t i = 0; i < H_num; i++) { J.hs_fs[i].swap(mesh.Hs[i].fs); J.hs_es[i].swap(mesh.Hs[i].es); }
+	J.active = true;
+
+	mesh.Vs.resize(V_num);
+	for (uint32_t i = 0; i < V_num; i++) { mesh.Vs[i].id = i; mesh.Vs[i].boundary = false; }
+	for (auto &h : mesh.Hs) for (auto vid : h.vs) mesh.Vs[vid].neighbor_hs.push_back(h.id);
 
-	Mesh_Topology mt_;
-	topology_info(mesh_, frame_, mt_);
-	return comp_topology(mt, mt_);
+	build_connectivity(mesh);
+	base_com.singularity_structure(si_, mesh);
+	if (!base_com.base_complex_extraction(si_, frame_, mesh)) { rollback_collapse(); return false; }
+	return true;
+}
+void simplification::rollback_collapse() {
+	Collapse_Journal &J = journal;
+	if (!J.active) return;
+	//back to the collapsed coordinates first, the slots below refer to them
+	for (auto it = J.smoothed.rbegin(); it != J.smoothed.rend(); ++it) mesh.V.col(it->first) = it->second;
+	for (uint32_t i = 0; i < J.hs_fs.size(); i++) { mesh.Hs[i].fs.swap(J.hs_fs[i]); mesh.Hs[i].es.swap(J.hs_es[i]); }
+	mesh.Hs.resize(J.H_num);
+	for (auto &m : J.hs_moved) { mesh.Hs[m.second] = std::move(mesh.Hs[m.first]); mesh.Hs[m.second].id = m.second; }
+	for (auto &r : J.hs_removed) mesh.Hs[r.first] = std::move(r.second);
+	for (auto &h : J.hs_vs) mesh.Hs[h.first].vs.swap(h.second);
+
+	mesh.V.conservativeResize(3, J.V_num);
+	for (auto &m : J.vs_moved) mesh.V.col(m.second) = mesh.V.col(m.first);
+	for (auto it = J.coords.rbegin(); it != J.coords.rend(); ++it) mesh.V.col(it->first) = it->second;
+
+	mesh.Vs.swap(J.Vs); mesh.Es.swap(J.Es); mesh.Fs.swap(J.Fs);
+	mesh.E_index.swap(J.E_index); mesh.F_index.swap(J.F_index);
+	commit_collapse();
+}
+void simplification::commit_collapse() {
+	Collapse_Journal &J = journal;
+	J.active = false;
+	vector<Hybrid_V>().swap(J.Vs); vector<Hybrid_E>().swap(J.Es); vector<Hybrid_F>().swap(J.Fs);
+	Vs_Index().swap(J.E_index); Vs_Index().swap(J.F_index);
+	J.hs_fs.clear(); J.hs_es.clear(); J.hs_vs.clear(); J.hs_removed.clear();
+	J.hs_moved.clear(); J.vs_moved.clear(); J.coords.clear(); J.smoothed.clear();
 }
-
 void simplification::optimization() {
-	
+	if (DD_Halo) { optimization_dd(); return; }
+	if (Quality_Target > 0) { optimization_local(); return; }
+
+	//with a smoothed coarse level a few fine passes are left
+	uint32_t passes = 5 * Slim_Iteration;
+	if (Multilevel && optimization_coarse()) passes = Slim_Iteration;
+
 	Mesh_Quality mq;
 	//quality
 	scaled_jacobian(mesh, mq);
@@ -1554,135 +1647,811 @@ void simplification::optimization() {
 	fc.lamda_L = 1e+3;
 	fc.lamda_T = 1e+3;
 	ts.fc = fc;
+	ts.local.rows_valid = false;
 	ts.global = true;
 	
 	Mesh_Quality mq_pre = mq;
-	mesh_ = mesh;
-	for (uint32_t i = 0; i < 5 * Slim_Iteration; i++) {
+	//only V changes: keep the accepted coordinates aside instead of a full mesh copy
+	MatrixXF V_pre;
+	double pass_ms = optimization_estimate();
+	slim_ctrl.begin(passes);
+	for (uint32_t i = 0; i < passes; i++) {
+		if (deadline_ms && remaining_ms() < pass_ms) {
+			cout << "deadline: stop optimizing after " << i << " passes" << endl; break;
+		}
+		Timer<> pass_timer;
 		ts.projection = false;
 
-		compute_referenceMesh(ts.V, mesh.Hs, CI.Hsregion, ts.RT);
+		compute_referenceMesh(ts.V, mesh.Hs, CI.Hsregion, ts.RT, ts.RT_cache, Reference_Tolerance);
 
 		slim_opt(ts, 1);
 
-		mesh_.V = ts.V.transpose();
+		V_pre.swap(mesh.V);
+		mesh.V = ts.V.transpose().cast<Float>();
 
-		scaled_jacobian(mesh_, mq);
-		if (mq_pre.min_Jacobian > mq.min_Jacobian) break;
-		if (!hausdorff_ratio_check(mf.tri, mesh_)) break;
-		
-		mesh.V = mesh_.V;
+		scaled_jacobian(mesh, mq);
+		if (mq_pre.min_Jacobian > mq.min_Jacobian || !hausdorff_ratio_check(mf.tri, mesh)) {
+			mesh.V.swap(V_pre);
+			break;
+		}
 		mq_pre = mq;
 
-		project_surface_update_feature(mf, ts.fc, ts.V, ts.s, ts.sc, 1);
+		project_features(ts, 1);
 		ts.projection = true;
+		pass_ms = pass_timer.value();
+		if (slim_converged(ts)) break;
+	}
+	scaled_jacobian(mesh, mq);
+	std::cout << "after: minimum scaled J: " << mq.min_Jacobian << " average scaled J: " << mq.ave_Jacobian << endl;
+
+	hausdorff_ratio_check(mf.tri, mesh);
+}
+void simplification::optimization_dd() {
+	Mesh_Quality mq;
+	scaled_jacobian(mesh, mq);
+	fc.lamda_C = 1e+3;
+	fc.lamda_L = 1e+3;
+	fc.lamda_T = 1e+3;
+	Feature_Constraints fc_dd = fc;
+
+	vector<Subdomain> subs;
+	build_subdomains(subs);
+	vector<vector<uint32_t>> colors;
+	for (uint32_t k = 0; k < subs.size(); k++) {
+		if (subs[k].color >= colors.size()) colors.resize(subs[k].color + 1);
+		colors[subs[k].color].push_back(k);
+	}
+	cout << "domain decomposition: " << subs.size() << " subdomains, " << colors.size() << " colors, halo " << DD_Halo << endl;
+
+	//colors run one after the other, the subdomains of a color concurrently against a snapshot
+	size_t threads = tbb::task_scheduler_init::default_num_threads();
+	MatrixXd V = mesh.V.transpose().cast<double>(), V_snap, sc;
+	VectorXi s;
+	vector<uint32_t> s_row;
+	bool projection = false;
+	Mesh_Quality mq_pre = mq;
+	MatrixXF V_pre;
+	double pass_ms = 0;
+	uint32_t passes = 5 * Slim_Iteration;
+	for (uint32_t i = 0; i < passes; i++) {
+		if (deadline_ms && remaining_ms() < pass_ms) {
+			cout << "deadline: stop optimizing after " << i << " passes" << endl; break;
+		}
+		Timer<> pass_timer;
+		if (projection) {
+			s_row.assign(mesh.Vs.size(), INVALID_V);
+			for (uint32_t k = 0; k < s.size(); k++) s_row[s[k]] = k;
+		}
+		for (auto &color : colors) {
+			V_snap = V;
+			//enough subdomains to fill the cores: each solve stays serial
+			size_t min_parallel = color.size() >= threads ? std::numeric_limits<size_t>::max() : 1000;
+			tbb::parallel_for(tbb::blocked_range<uint32_t>(0u, (uint32_t)color.size(), 1),
+				[&](const tbb::blocked_range<uint32_t> &range) {
+				for (uint32_t k = range.begin(); k != range.end(); k++)
+					smooth_subdomain(subs[color[k]], fc_dd, V_snap, V, projection, s_row, sc, min_parallel);
+			});
+		}
+
+		V_pre.swap(mesh.V);
+		mesh.V = V.transpose().cast<Float>();
+		scaled_jacobian(mesh, mq);
+		if (mq_pre.min_Jacobian > mq.min_Jacobian || !hausdorff_ratio_check(mf.tri, mesh)) {
+			mesh.V.swap(V_pre);
+			break;
+		}
+		mq_pre = mq;
+
+		project_surface_update_feature(mf, fc_dd, V, s, sc, 1);
+		projection = true;
+		pass_ms = pass_timer.value();
+		//no subdomain lowers its energy noticeably any more
+		double decrease = 0;
+		for (auto &sd : subs) decrease = std::max(decrease, sd.ctrl.decrease);
+		if (Slim_Adaptive && decrease < slim_ctrl.energy_tol) { slim_ctrl.saved += passes - i - 1; break; }
+	}
+	scaled_jacobian(mesh, mq);
+	std::cout << "after: minimum scaled J: " << mq.min_Jacobian << " average scaled J: " << mq.ave_Jacobian << endl;
+
+	hausdorff_ratio_check(mf.tri, mesh);
+}
+bool simplification::optimization_coarse() {
+	fc.lamda_C = 1e+3;
+	fc.lamda_L = 1e+3;
+	fc.lamda_T = 1e+3;
+	vector<uint32_t> cuboid;
+	MatrixXd W;
+	if (frame.FHs.empty() || !cuboid_parameters(cuboid, W)) {
+		cout << "multilevel: the base complex has no structured cuboids, fine level only" << endl;
+		return false;
+	}
+	MatrixXd V = mesh.V.transpose().cast<double>();
+
+	//the base complex as a hex mesh over its nodes, corners ordered like the fine hexes
+	Subdomain sd;
+	vector<uint32_t> local(mesh.Vs.size(), INVALID_V);
+	for (auto &fv : frame.FVs) { local[fv.hid] = sd.vs.size(); sd.vs.push_back(fv.hid); }
+	sd.hs.resize(frame.FHs.size());
+	Vector3d cs[8];
+	for (auto &fh : frame.FHs) {
+		Hybrid &h = sd.hs[fh.id];
+		h.id = fh.id; h.vs = fh.vs;
+		for (uint32_t j = 0; j < 8; j++) cs[j] = V.row(frame.FVs[fh.vs[j]].hid).transpose();
+		if (hex_scaled_jacobian(cs) > 0) continue;
+		std::swap(h.vs[1], h.vs[3]); std::swap(h.vs[5], h.vs[7]);
+		std::swap(cs[1], cs[3]); std::swap(cs[5], cs[7]);
+		if (hex_scaled_jacobian(cs) > 0) continue;
+		for (auto vid : sd.vs) local[vid] = INVALID_V;
+		cout << "multilevel: cuboid " << fh.id << " is inverted as a coarse hex, fine level only" << endl;
+		return false;
+	}
+	for (uint32_t i = 0; i < sd.vs.size(); i++) sd.owned.push_back(i);
+	localize_subdomain(sd, local);
+
+	MatrixXd V_c = V, sc;
+	vector<uint32_t> s_row;
+	uint32_t iter = 0;
+	while (iter < 5 * Slim_Iteration) {
+		smooth_subdomain(sd, fc, V_c, V_c, false, s_row, sc, 1000);
+		iter++;
+		if (Slim_Adaptive && sd.ctrl.decrease < slim_ctrl.energy_tol) break;
+	}
+
+	//prolongation: node displacements interpolated into the cuboids
+	MatrixXd D(mesh.Vs.size(), 3); D.setZero();
+	for (uint32_t vid = 0; vid < mesh.Vs.size(); vid++) if (cuboid[vid] != INVALID_V) {
+		const Frame_H &fh = frame.FHs[cuboid[vid]];
+		for (uint32_t j = 0; j < 8; j++) {
+			uint32_t hid = frame.FVs[fh.vs[j]].hid;
+			D.row(vid) += W(vid, j) * (V_c.row(hid) - V.row(hid));
+		}
+	}
+	Mesh_Quality mq_pre, mq;
+	scaled_jacobian(mesh, mq_pre);
+	MatrixXF V_pre = mesh.V;
+	double step = 1;
+	for (uint32_t k = 0; k < 4; k++, step /= 2) {
+		mesh.V = (V + step * D).transpose().cast<Float>();
+		scaled_jacobian(mesh, mq);
+		if (mq.min_Jacobian >= mq_pre.min_Jacobian && hausdorff_ratio_check(mf.tri, mesh)) {
+			cout << "multilevel: " << frame.FHs.size() << " coarse hexes, " << iter << " coarse iterations, step " << step
+				<< ", minimum scaled J: " << mq_pre.min_Jacobian << " -> " << mq.min_Jacobian << endl;
+			return true;
+		}
+	}
+	mesh.V.swap(V_pre);
+	cout << "multilevel: the interpolated coarse level lowers the quality, fine level only" << endl;
+	return false;
+}
+bool simplification::cuboid_parameters(vector<uint32_t> &cuboid, MatrixXd &W) {
+	//trilinear weights of the 8 cuboid corners for every vertex, from its edge distances to the opposite cuboid faces
+	cuboid.assign(mesh.Vs.size(), INVALID_V);
+	W.setZero(mesh.Vs.size(), 8);
+	vector<uint32_t> local(mesh.Vs.size(), INVALID_V);
+	for (auto &fh : frame.FHs) {
+		if (fh.fs.size() != 6 || fh.vs.size() != 8) return false;
+		for (uint32_t j = 0; j < 6; j++) if (fh.fs_op[j] < 0) return false;
+		Scratch_Scope scope(pool);
+		Epoch_Flags &E_flag = pool.flag(mesh.Es.size());
+		vector<uint32_t> vs;
+		for (auto hid : fh.hs_net) for (auto vid : mesh.Hs[hid].vs)
+			if (local[vid] == INVALID_V) { local[vid] = vs.size(); vs.push_back(vid); }
+		//hex es are not kept by build_connectivity, the edges come from the hex faces
+		vector<vector<uint32_t>> adj(vs.size());
+		for (auto hid : fh.hs_net) for (auto fid : mesh.Hs[hid].fs) for (auto eid : mesh.Fs[fid].es) if (!E_flag[eid]) {
+			E_flag.set(eid);
+			uint32_t v0 = local[mesh.Es[eid].vs[0]], v1 = local[mesh.Es[eid].vs[1]];
+			adj[v0].push_back(v1); adj[v1].push_back(v0);
+		}
+		//breadth-first distances to each cuboid face; in a structured block they are the grid indices
+		MatrixXi dis(vs.size(), 6); dis.setConstant(-1);
+		for (uint32_t j = 0; j < 6; j++) {
+			std::queue<uint32_t> front;
+			for (auto fid : frame.FFs[fh.fs[j]].ffs_net) for (auto vid : mesh.Fs[fid].vs)
+				if (local[vid] != INVALID_V && dis(local[vid], j) < 0) { dis(local[vid], j) = 0; front.push(local[vid]); }
+			while (!front.empty()) {
+				uint32_t v = front.front(); front.pop();
+				for (auto nv : adj[v]) if (dis(nv, j) < 0) { dis(nv, j) = dis(v, j) + 1; front.push(nv); }
+			}
+		}
+		//three pairs of opposite faces, and the side of each corner
+		uint32_t axis[3] = { 0, 0, 0 }, na = 1;
+		for (uint32_t j = 1; j < 6 && na < 3; j++) {
+			bool used = false;
+			for (uint32_t a = 0; a < na; a++) if (j == axis[a] || j == (uint32_t)fh.fs_op[axis[a]]) used = true;
+			if (!used) axis[na++] = j;
+		}
+		bool structured = na == 3;
+		bool near[8][3];
+		for (uint32_t c = 0; c < 8 && structured; c++) for (uint32_t a = 0; a < 3; a++) {
+			const vector<uint32_t> &f0 = frame.FFs[fh.fs[axis[a]]].vs, &f1 = frame.FFs[fh.fs[fh.fs_op[axis[a]]]].vs;
+			near[c][a] = std::find(f0.begin(), f0.end(), fh.vs[c]) != f0.end();
+			if (near[c][a] == (std::find(f1.begin(), f1.end(), fh.vs[c]) != f1.end())) structured = false;
+		}
+		for (uint32_t i = 0; i < vs.size() && structured; i++) {
+			double t[3];
+			for (uint32_t a = 0; a < 3; a++) {
+				int d0 = dis(i, axis[a]), d1 = dis(i, fh.fs_op[axis[a]]);
+				if (d0 < 0 || d1 < 0 || d0 + d1 == 0) { structured = false; break; }
+				t[a] = (double)d0 / (d0 + d1);
+			}
+			if (!structured || cuboid[vs[i]] != INVALID_V) continue;
+			cuboid[vs[i]] = fh.id;
+			for (uint32_t c = 0; c < 8; c++) {
+				double w = 1;
+				for (uint32_t a = 0; a < 3; a++) w *= near[c][a] ? 1 - t[a] : t[a];
+				W(vs[i], c) = w;
+			}
+		}
+		for (auto vid : vs) local[vid] = INVALID_V;
+		if (!structured) return false;
+	}
+	return true;
+}
+void simplification::optimization_local() {
+	Mesh_Quality mq;
+	scaled_jacobian(mesh, mq);
+	fc.lamda_C = 1e+3;
+	fc.lamda_L = 1e+3;
+	fc.lamda_T = 1e+3;
+	Feature_Constraints fc_loc = fc;
+	//regions are Slim_region rings of hexes around a single seed
+	width_sheet = 1;
+
+	size_t threads = tbb::task_scheduler_init::default_num_threads();
+	MatrixXd V = mesh.V.transpose().cast<double>(), sc;
+	VectorXi s;
+	vector<uint32_t> s_row, local(mesh.Vs.size(), INVALID_V);
+	Tetralize_Set ts_grow;
+	bool projection = false;
+	Mesh_Quality mq_pre = mq;
+	MatrixXF V_pre;
+	double pass_ms = 0;
+	uint32_t passes = 5 * Slim_Iteration;
+	//minimum and sum of the hex scaled jacobians of a region
+	auto region_quality = [&](const Subdomain &sd, double &minJ, double &sumJ) {
+		minJ = 1; sumJ = 0;
+		Vector3d cs[8];
+		for (auto &h : sd.hs) {
+			for (uint32_t j = 0; j < 8; j++) cs[j] = V.row(sd.vs[h.vs[j]]).transpose();
+			double J = hex_scaled_jacobian(cs);
+			minJ = std::min(minJ, J); sumJ += J;
+		}
+	};
+	for (uint32_t i = 0; i < passes; i++) {
+		if (mq.min_Jacobian >= Quality_Target) break;
+		if (deadline_ms && remaining_ms() < pass_ms) {
+			cout << "deadline: stop optimizing after " << i << " passes" << endl; break;
+		}
+		Timer<> pass_timer;
+		//worst hexes first, a hex inside an earlier region seeds none
+		vector<uint32_t> seeds;
+		for (uint32_t hid = 0; hid < mesh.Hs.size(); hid++) if (mq.H_Js[hid] < Quality_Target) seeds.push_back(hid);
+		std::sort(seeds.begin(), seeds.end(), [&](uint32_t a, uint32_t b) { return mq.H_Js[a] < mq.H_Js[b]; });
+		vector<Subdomain> subs;
+		{
+			Scratch_Scope scope(pool);
+			Epoch_Flags &R_flag = pool.flag(mesh.Hs.size());
+			for (auto seed : seeds) if (!R_flag[seed]) {
+				Scratch_Scope scope_seed(pool);
+				Epoch_Flags &H_flag = pool.flag(mesh.Hs.size());
+				H_flag.set(seed);
+				vector<uint32_t> fs = mesh.Hs[seed].fs, regionFs, hs;
+				grow_region2(1, fs, regionFs, hs, ts_grow, H_flag, mesh, false);
+				hs.insert(hs.begin(), seed);
+				for (auto hid : hs) R_flag.set(hid);
+				subs.emplace_back();
+				setup_subdomain(subs.back(), hs, local);
+			}
+		}
+		//regions sharing no vertex are smoothed concurrently
+		vector<vector<uint32_t>> batches;
+		vector<bool> scheduled(subs.size(), false);
+		size_t left = subs.size();
+		while (left) {
+			Scratch_Scope scope(pool);
+			Epoch_Flags &V_flag = pool.flag(mesh.Vs.size());
+			batches.emplace_back();
+			for (uint32_t k = 0; k < subs.size(); k++) if (!scheduled[k]) {
+				bool disjoint = true;
+				for (auto vid : subs[k].vs) if (V_flag[vid]) { disjoint = false; break; }
+				if (!disjoint) continue;
+				for (auto vid : subs[k].vs) V_flag.set(vid);
+				subs[k].color = batches.size() - 1;
+				batches.back().push_back(k);
+				scheduled[k] = true; left--;
+			}
+		}
+		if (projection) {
+			s_row.assign(mesh.Vs.size(), INVALID_V);
+			for (uint32_t k = 0; k < s.size(); k++) s_row[s[k]] = k;
+		}
+		std::atomic<uint32_t> improved(0);
+		for (auto &batch : batches) {
+			size_t min_parallel = batch.size() >= threads ? std::numeric_limits<size_t>::max() : 1000;
+			tbb::parallel_for(tbb::blocked_range<uint32_t>(0u, (uint32_t)batch.size(), 1),
+				[&](const tbb::blocked_range<uint32_t> &range) {
+				for (uint32_t k = range.begin(); k != range.end(); k++) {
+					Subdomain &sd = subs[batch[k]];
+					double minJ_pre, sumJ_pre, minJ, sumJ;
+					region_quality(sd, minJ_pre, sumJ_pre);
+					MatrixXd V_owned(sd.owned.size(), 3);
+					for (uint32_t j = 0; j < sd.owned.size(); j++) V_owned.row(j) = V.row(sd.vs[sd.owned[j]]);
+					//the other regions of the batch touch none of these rows
+					smooth_subdomain(sd, fc_loc, V, V, projection, s_row, sc, min_parallel);
+					//kept only if the worst hex of the region did not get worse and the region improved
+					region_quality(sd, minJ, sumJ);
+					if (minJ < minJ_pre || (minJ == minJ_pre && sumJ <= sumJ_pre)) {
+						for (uint32_t j = 0; j < sd.owned.size(); j++) V.row(sd.vs[sd.owned[j]]) = V_owned.row(j);
+					}
+					else improved++;
+				}
+			});
+		}
+
+		V_pre.swap(mesh.V);
+		mesh.V = V.transpose().cast<Float>();
+		scaled_jacobian(mesh, mq);
+		if (mq_pre.min_Jacobian > mq.min_Jacobian || !hausdorff_ratio_check(mf.tri, mesh)) {
+			mesh.V.swap(V_pre);
+			mq = mq_pre;
+			break;
+		}
+		mq_pre = mq;
+		cout << "local pass " << i << ": " << seeds.size() << " hexes below " << Quality_Target << ", " << subs.size() << " regions in "
+			<< batches.size() << " batches, " << improved << " improved, minimum scaled J: " << mq.min_Jacobian << endl;
+		if (!improved) break;
+
+		project_surface_update_feature(mf, fc_loc, V, s, sc, 1);
+		projection = true;
+		pass_ms = pass_timer.value();
 	}
 	scaled_jacobian(mesh, mq);
 	std::cout << "after: minimum scaled J: " << mq.min_Jacobian << " average scaled J: " << mq.ave_Jacobian << endl;
 
 	hausdorff_ratio_check(mf.tri, mesh);
 }
+void simplification::build_subdomains(vector<Subdomain> &subs) {
+	//a vertex is owned by the first cuboid holding it
+	vector<uint32_t> owner(mesh.Vs.size(), INVALID_V), local(mesh.Vs.size(), INVALID_V);
+	for (auto &fh : frame.FHs) for (auto hid : fh.hs_net) for (auto vid : mesh.Hs[hid].vs) if (owner[vid] == INVALID_V) owner[vid] = fh.id;
+
+	subs.clear(); subs.resize(frame.FHs.size());
+	for (auto &fh : frame.FHs) {
+		vector<uint32_t> hs = fh.hs_net;
+		{
+			Scratch_Scope scope(pool);
+			Epoch_Flags &H_flag = pool.flag(mesh.Hs.size());
+			for (auto hid : hs) H_flag.set(hid);
+			size_t ring_begin = 0;
+			for (uint32_t r = 0; r < DD_Halo; r++) {
+				size_t ring_end = hs.size();
+				for (size_t k = ring_begin; k < ring_end; k++)
+					for (auto fid : mesh.Hs[hs[k]].fs) for (auto nhid : mesh.Fs[fid].neighbor_hs)
+						if (!H_flag[nhid]) { H_flag.set(nhid); hs.push_back(nhid); }
+				ring_begin = ring_end;
+			}
+		}
+		Subdomain &sd = subs[fh.id];
+		sd.color = fh.Color_ID;
+		setup_subdomain(sd, hs, local);
+		vector<uint32_t> owned;
+		for (auto i : sd.owned) if (owner[sd.vs[i]] == fh.id) owned.push_back(i);
+		sd.owned.swap(owned);
+	}
+}
+void simplification::setup_subdomain(Subdomain &sd, const vector<uint32_t> &hs, vector<uint32_t> &local) {
+	Scratch_Scope scope(pool);
+	Epoch_Flags &H_flag = pool.flag(mesh.Hs.size()), &F_flag = pool.flag(mesh.Fs.size()), &V_flag = pool.flag(mesh.Vs.size());
+	for (auto hid : hs) H_flag.set(hid);
+	//local vertices; the ones on faces to the rest of the mesh are frozen
+	for (auto hid : hs) for (auto vid : mesh.Hs[hid].vs)
+		if (local[vid] == INVALID_V) { local[vid] = sd.vs.size(); sd.vs.push_back(vid); }
+	for (auto hid : hs) for (auto fid : mesh.Hs[hid].fs) if (!F_flag[fid] && !mesh.Fs[fid].boundary) {
+		F_flag.set(fid);
+		uint32_t h0 = mesh.Fs[fid].neighbor_hs[0], h1 = mesh.Fs[fid].neighbor_hs[1];
+		if (H_flag[h0] == H_flag[h1]) continue;
+		for (auto vid : mesh.Fs[fid].vs) if (!V_flag[vid]) { V_flag.set(vid); sd.frozen_vs.push_back(vid); }
+	}
+	for (uint32_t i = 0; i < sd.vs.size(); i++) if (!V_flag[sd.vs[i]]) sd.owned.push_back(i);
+
+	sd.hs.resize(hs.size());
+	for (uint32_t k = 0; k < hs.size(); k++) {
+		sd.hs[k].id = k; sd.hs[k].vs.resize(8);
+		for (uint32_t j = 0; j < 8; j++) sd.hs[k].vs[j] = local[mesh.Hs[hs[k]].vs[j]];
+	}
+	localize_subdomain(sd, local);
+}
+void simplification::localize_subdomain(Subdomain &sd, vector<uint32_t> &local) {
+	//sd.vs, sd.hs in local ids and sd.frozen_vs are set, local maps sd.vs back
+	Tetralize_Set &ts = sd.ts;
+	sd.hs_ids.resize(sd.hs.size());
+	ts.T.resize(8 * sd.hs.size(), 4);
+	for (uint32_t k = 0; k < sd.hs.size(); k++) {
+		sd.hs_ids[k] = k;
+		for (uint32_t i = 0; i < 8; i++)
+			for (uint32_t j = 0; j < 4; j++) ts.T(8 * k + i, j) = sd.hs[k].vs[hex_tetra_table[i][j]];
+	}
+	ts.V.resize(sd.vs.size(), 3);
+	ts.b.resize(0); ts.bc.resize(0, 3);
+	ts.regionb.resize(sd.frozen_vs.size()); ts.regionbc.resize(sd.frozen_vs.size(), 3);
+	for (uint32_t i = 0; i < sd.frozen_vs.size(); i++) ts.regionb[i] = local[sd.frozen_vs[i]];
+	ts.global = true;
+	localize_ts(ts);
+
+	//feature constraints inside, in local ids; the targets are copied in every pass
+	Feature_Constraints &sfc = ts.fc;
+	sfc.lamda_C = fc.lamda_C; sfc.lamda_L = fc.lamda_L; sfc.lamda_T = fc.lamda_T;
+	for (uint32_t i = 0; i < fc.ids_C.size(); i++) if (local[fc.ids_C[i]] != INVALID_V) sd.C_rows.push_back(i);
+	for (uint32_t i = 0; i < fc.ids_L.size(); i++) if (local[fc.ids_L[i]] != INVALID_V) sd.L_rows.push_back(i);
+	for (uint32_t i = 0; i < fc.ids_T.size(); i++) if (local[fc.ids_T[i]] != INVALID_V) sd.T_rows.push_back(i);
+	sfc.ids_C.resize(sd.C_rows.size()); sfc.C.resize(sd.C_rows.size(), 3);
+	for (uint32_t i = 0; i < sd.C_rows.size(); i++) sfc.ids_C[i] = local[fc.ids_C[sd.C_rows[i]]];
+	sfc.num_a = sd.L_rows.size(); sfc.ids_L.resize(sd.L_rows.size()); sfc.Axa_L.resize(sd.L_rows.size(), 3); sfc.origin_L.resize(sd.L_rows.size(), 3);
+	for (uint32_t i = 0; i < sd.L_rows.size(); i++) sfc.ids_L[i] = local[fc.ids_L[sd.L_rows[i]]];
+	sfc.ids_T.resize(sd.T_rows.size()); sfc.normal_T.resize(sd.T_rows.size(), 3); sfc.dis_T.resize(sd.T_rows.size());
+	for (uint32_t i = 0; i < sd.T_rows.size(); i++) sfc.ids_T[i] = local[fc.ids_T[sd.T_rows[i]]];
+
+	for (auto vid : sd.vs) local[vid] = INVALID_V;
+}
+void simplification::smooth_subdomain(Subdomain &sd, const Feature_Constraints &fcc, const MatrixXd &V_in, MatrixXd &V_out,
+	bool projection, const vector<uint32_t> &s_row, const MatrixXd &sc, size_t min_parallel) {
+	Tetralize_Set &ts = sd.ts;
+	for (uint32_t i = 0; i < sd.vs.size(); i++) ts.V.row(i) = V_in.row(sd.vs[i]);
+	for (uint32_t i = 0; i < sd.frozen_vs.size(); i++) ts.regionbc.row(i) = V_in.row(sd.frozen_vs[i]);
+	Feature_Constraints &sfc = ts.fc;
+	for (uint32_t i = 0; i < sd.C_rows.size(); i++) sfc.C.row(i) = fcc.C.row(sd.C_rows[i]);
+	for (uint32_t i = 0; i < sd.L_rows.size(); i++) {
+		sfc.Axa_L.row(i) = fcc.Axa_L.row(sd.L_rows[i]);
+		sfc.origin_L.row(i) = fcc.origin_L.row(sd.L_rows[i]);
+	}
+	for (uint32_t i = 0; i < sd.T_rows.size(); i++) {
+		sfc.normal_T.row(i) = fcc.normal_T.row(sd.T_rows[i]);
+		sfc.dis_T[i] = fcc.dis_T[sd.T_rows[i]];
+	}
+	ts.projection = projection;
+	if (projection) {
+		uint32_t n = 0;
+		for (auto vid : sd.vs) if (s_row[vid] != INVALID_V) n++;
+		VectorXi s(n);
+		ts.sc.resize(n, 3); n = 0;
+		for (uint32_t i = 0; i < sd.vs.size(); i++) if (s_row[sd.vs[i]] != INVALID_V) {
+			s[n] = i;
+			ts.sc.row(n++) = sc.row(s_row[sd.vs[i]]);
+		}
+		//the rows are rebuilt only when another set of vertices is projected
+		if (s.size() != ts.s.size() || s != ts.s) { ts.s.swap(s); ts.local.rows_valid = false; }
+	}
+
+	compute_referenceMesh(ts.V, sd.hs, sd.hs_ids, ts.RT, ts.RT_cache, Reference_Tolerance);
+	slim_region(ts, 1, sd.pattern, nullptr, sd.ctrl, min_parallel);
+	//owned vertices are disjoint across subdomains
+	for (auto i : sd.owned) V_out.row(sd.vs[i]) = ts.V.row(i);
+}
+void simplification::slim_benchmark(double tolerance) {
+	//the global smoothing of optimization() without projection and checks: plain against accelerated iterations
+	Slim_global_region = mesh.Hs.size();
+	OPTIMIZATION_ONLY = true;
+	CI.target_vs.resize(0);
+	fc.lamda_C = 1e+3;
+	fc.lamda_L = 1e+3;
+	fc.lamda_T = 1e+3;
+	MatrixXF V0 = mesh.V;
+	uint32_t window = Slim_Anderson ? Slim_Anderson : 5, max_iter = 20 * Slim_Iteration;
+	for (uint32_t run = 0; run < 2; run++) {
+		mesh.V = V0;
+		set_slim_anderson(run ? window : 0);
+		tetralize_mesh_omesh(ts, mesh);
+		ts.fc = fc;
+		ts.local.rows_valid = false;
+		ts.global = true;
+		ts.projection = false;
+		//both runs start cold: no system pattern and no reference cuboids from the previous one
+		slim_pattern.reset();
+		ts.RT_cache = Reference_Cache();
+
+		Timer<> timer;
+		uint32_t i = 0;
+		while (i < max_iter) {
+			compute_referenceMesh(ts.V, mesh.Hs, CI.Hsregion, ts.RT, ts.RT_cache, Reference_Tolerance);
+			slim_opt(ts, 1); i++;
+			if (slim_ctrl.decrease < tolerance) break;
+		}
+		size_t ms = timer.value();
+		mesh.V = ts.V.transpose().cast<Float>();
+		Mesh_Quality mq;
+		scaled_jacobian(mesh, mq);
+		if (run) std::cout << "anderson(" << window << "): ";
+		else std::cout << "plain: ";
+		std::cout << i << " iterations to " << tolerance << " relative decrease, " << ms << " ms, energy " << slim_ctrl.energy
+			<< ", minimum scaled J " << mq.min_Jacobian;
+		if (run) std::cout << ", extrapolations accepted " << slim_anderson->accepted << " rejected " << slim_anderson->rejected;
+		std::cout << endl;
+	}
+	mesh.V = V0;
+	set_slim_anderson(0);
+}
+double simplification::remaining_ms() {
+	return (double)deadline_ms - (double)deadline_clock.value();
+}
+double simplification::optimization_estimate() {
+	//one global pass over the 8 tets of each hex, twice the solve for tetralization, checks and output
+	return 2 * 8 * slim_ms_per_tet * mesh.Hs.size();
+}
+bool simplification::time_for(double ms) {
+	if (!deadline_ms) return true;
+	//5% of the budget is kept as margin for writing the result
+	return remaining_ms() >= ms + optimization_estimate() + 0.05 * deadline_ms;
+}
+bool simplification::slim_converged(Tetralize_Set &ts) {
+	Slim_Control &sc = slim_ctrl;
+	sc.rounds++;
+	if (!Slim_Adaptive || sc.rounds >= sc.bound) return false;
+	//scale of the region, from the first edge of each corner tet
+	if (sc.edge_len == 0) {
+		for (uint32_t i = 0; i < ts.T.rows(); i++) sc.edge_len += (ts.V.row(ts.T(i, 1)) - ts.V.row(ts.T(i, 0))).norm();
+		sc.edge_len = ts.T.rows() ? sc.edge_len / ts.T.rows() : 1;
+	}
+	sc.residual = 0;
+	for (uint32_t i = 0; i < ts.s.size() && i < ts.sc.rows(); i++) sc.residual = std::max(sc.residual, (ts.V.row(ts.s[i]) - ts.sc.row(i)).norm());
+	//the tets are hex corners: their scaled jacobian is the hex one
+	sc.min_J = 1;
+	for (uint32_t i = 0; i < ts.T.rows(); i++) {
+		Matrix3d J;
+		for (uint32_t j = 0; j < 3; j++) J.col(j) = (ts.V.row(ts.T(i, j + 1)) - ts.V.row(ts.T(i, 0))).transpose();
+		double norm = J.col(0).norm() * J.col(1).norm() * J.col(2).norm();
+		sc.min_J = std::min(sc.min_J, norm > 0 ? J.determinant() / norm : -1.0);
+	}
+	bool progress = sc.decrease > sc.energy_tol || sc.min_J > sc.best_J + sc.jacobian_tol;
+	sc.best_J = std::max(sc.best_J, sc.min_J);
+	sc.stalled = progress ? 0 : sc.stalled + 1;
+
+	bool converged = sc.decrease <= sc.energy_tol && sc.move <= sc.move_tol * sc.edge_len && sc.residual <= sc.residual_tol * sc.edge_len;
+	if (!converged && sc.stalled < sc.stall_rounds) return false;
+	sc.saved += sc.bound - sc.rounds;
+	return true;
+}
+void simplification::candidate_parameters(Tuple_Candidate &c) {
+	uint32_t feid;
+	if (std::get<1>(c) == Base_Set::SHEET) {
+		uint32_t sheet_id = std::get<0>(c);
+		feid = All_Sheets[sheet_id].middle_es[0];
+	}
+	else if (std::get<1>(c) == Base_Set::CHORD) {
+		uint32_t chord_id = std::get<0>(c);
+		feid = All_Chords[chord_id].parallel_es[0][0];
+	}
+
+	Float resolution = frame.FEs[feid].es_link.size();
+	Projection_range = resolution + 1;
+	Slim_Iteration = resolution * Slim_Iteration_base;
+	if (Slim_Iteration > Slim_Iteration_Limit) Slim_Iteration = Slim_Iteration_Limit;
+
+	if (Projection_range > Projection_limit)Projection_range = Projection_limit;
+
+	width_sheet = resolution;
+}
+uint64_t simplification::candidate_signature(Tuple_Candidate &c) {
+	//hexes of the candidate's cuboids, the rings grow_region2 adds for its smoothing region,
+	//and the vertex one-ring of that region: every hex whose shape the collapse can change
+	uint32_t id = get<0>(c);
+	bool sheet = get<1>(c) == Base_Set::SHEET;
+	vector<uint32_t> &cs = sheet ? All_Sheets[id].cs : All_Chords[id].cs;
+	uint32_t feid = sheet ? All_Sheets[id].middle_es[0] : All_Chords[id].parallel_es[0][0];
+	int ringN = frame.FEs[feid].es_link.size() * Slim_region;
+	Scratch_Scope scope(pool);
+	Epoch_Flags &H_flag = pool.flag(mesh.Hs.size());
+	vector<uint32_t> hs;
+	for (auto cid : cs) for (auto hid : frame.FHs[cid].hs_net) if (!H_flag[hid]) { H_flag.set(hid); hs.push_back(hid); }
+	//which cuboids collapse: the core hexes in cuboid order
+	uint64_t core = ordered_geometry_hash(mesh, hs);
+	size_t ring_begin = 0;
+	for (int r = 0; r < ringN; r++) {
+		size_t ring_end = hs.size();
+		for (size_t k = ring_begin; k < ring_end; k++)
+			for (auto fid : mesh.Hs[hs[k]].fs) for (auto nhid : mesh.Fs[fid].neighbor_hs)
+				if (!H_flag[nhid]) { H_flag.set(nhid); hs.push_back(nhid); }
+		if (ring_end == hs.size()) break;
+		ring_begin = ring_end;
+	}
+	size_t region_num = hs.size();
+	for (size_t i = 0; i < region_num; i++)
+		for (auto vid : mesh.Hs[hs[i]].vs) for (auto nhid : mesh.Vs[vid].neighbor_hs)
+			if (!H_flag[nhid]) { H_flag.set(nhid); hs.push_back(nhid); }
+	return geometry_hash(mesh, hs) ^ (core * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)get<1>(c) << 63);
+}
+void simplification::collapse_region(const vector<uint32_t> &core_hs, vector<uint32_t> &region_hs) {
+	//core_hs plus the rings tetralize_mesh would grow around it with the current width_sheet
+	Scratch_Scope scope(pool);
+	Epoch_Flags &F_flag = pool.flag(mesh.Fs.size()), &H_flag = pool.flag(mesh.Hs.size());
+	for (auto hid : core_hs) H_flag.set(hid);
+	vector<uint32_t> fs, regionFs;
+	for (auto hid : core_hs)
+		for (auto fid : mesh.Hs[hid].fs) if (!F_flag[fid] && !mesh.Fs[fid].boundary) {
+			uint32_t h0 = mesh.Fs[fid].neighbor_hs[0], h1 = mesh.Fs[fid].neighbor_hs[1];
+			if (H_flag[h0] != H_flag[h1]) { fs.push_back(fid); F_flag.set(fid); }
+		}
+	Tetralize_Set ts_temp;
+	grow_region2(core_hs.size(), fs, regionFs, region_hs, ts_temp, H_flag, mesh, false);
+	region_hs.insert(region_hs.end(), core_hs.begin(), core_hs.end());
+}
+uint32_t simplification::remove_batch() {
+	//the feature filters build CI, without them there is nothing to merge
+	if (!TOPOLOGY && !SHARP_FEATURE) return 0;
+	if (!time_for(Batch_Size * candidate_ms + update_ms)) return 0;
+
+	Scratch_Scope scope(pool);
+	Epoch_Flags &V_taken = pool.flag(mesh.Vs.size());
+	//greedy independent set: smoothing regions may not share a vertex
+	auto take_region = [&](const vector<uint32_t> &core_hs) {
+		vector<uint32_t> region_hs;
+		collapse_region(core_hs, region_hs);
+		for (auto hid : region_hs) for (auto vid : mesh.Hs[hid].vs) if (V_taken[vid]) return false;
+		for (auto hid : region_hs) for (auto vid : mesh.Hs[hid].vs) V_taken.set(vid);
+		return true;
+	};
+	vector<Collapse_Info> CIs;
+	vector<uint32_t> batch, iterations, widths, ranges;
+	uint32_t width_max = 0;
+	for (uint32_t i = 0; i < Candidates.size() && batch.size() < Batch_Size; i++) {
+		uint64_t key;
+		if (!filter_feature(Candidates[i], key)) continue;
+		candidate_parameters(Candidates[i]);
+		if (!take_region(CI.hs)) continue;
+		CIs.push_back(CI);
+		iterations.push_back(Slim_Iteration); widths.push_back((uint32_t)width_sheet); ranges.push_back((uint32_t)Projection_range);
+		width_max = std::max(width_max, widths.back());
+		batch.push_back(i);
+	}
+	if (batch.size() < 2) return 0;
+
+	//the batch is smoothed with the widest candidate's width: re-check the regions at that width
+	width_sheet = width_max;
+	V_taken.begin(mesh.Vs.size());
+	Collapse_Info CI_batch;
+	uint32_t Slim_Iteration_max = 0, Projection_max = 0, merged = 0;
+	width_max = 0;
+	for (uint32_t k = 0; k < CIs.size(); k++) {
+		if (!take_region(CIs[k].hs)) continue;
+		Collapse_Info &ci = CIs[k];
+		CI_batch.V_Groups.insert(CI_batch.V_Groups.end(), ci.V_Groups.begin(), ci.V_Groups.end());
+		CI_batch.hs.insert(CI_batch.hs.end(), ci.hs.begin(), ci.hs.end());
+		uint32_t rows = CI_batch.target_vs.size();
+		CI_batch.target_vs.conservativeResize(rows + ci.target_vs.size());
+		CI_batch.target_vs.segment(rows, ci.target_vs.size()) = ci.target_vs;
+		CI_batch.target_coords.conservativeResize(rows + ci.target_coords.rows(), 3);
+		CI_batch.target_coords.block(rows, 0, ci.target_coords.rows(), 3) = ci.target_coords;
+
+		//dropping a candidate only narrows the width, the kept regions stay disjoint
+		Slim_Iteration_max = std::max(Slim_Iteration_max, iterations[k]);
+		width_max = std::max(width_max, widths[k]);
+		Projection_max = std::max(Projection_max, ranges[k]);
+		merged++;
+	}
+	if (merged < 2) return 0;
+
+	//one collapse, one topology check, one joint smoothing of the disjoint regions
+	CI = CI_batch;
+	Slim_Iteration = Slim_Iteration_max; width_sheet = width_max; Projection_range = Projection_max;
+	if (TOPOLOGY && !topology_check()) {
+		cout << "batch of " << merged << " rejected, removing sequentially" << endl;
+		return 0;
+	}
+	if (!direct_collapse()) {
+		cout << "batch of " << merged << " rejected, removing sequentially" << endl;
+		return 0;
+	}
+	cout << "removed a batch of " << merged << endl;
+	return merged;
+}
 bool simplification::direct_collapse() {
 	Mesh_Quality mq;
 
 	OPTIMIZATION_ONLY = false;
+	//topology filters off: the candidate has not been collapsed yet
+	if (!journal.active && !apply_collapse()) return false;
 
-	tetralize_mesh(ts);
 	ts.fc = fc;
 	ts.global = true;
 	ts.projection = false;
 	ts.s.resize(0); ts.sc.resize(0, 3);
+	ts.local.rows_valid = false;
+	slim_ctrl.begin(Slim_Iteration);
 	for (uint32_t i = 0; i < Slim_Iteration; i++) {
 		ts.projection = false;
 
-		compute_referenceMesh(ts.V, mesh.Hs, CI.Hsregion, ts.RT);
+		compute_referenceMesh(ts.V, CI.region_hs, CI.region_ids, ts.RT, ts.RT_cache, Reference_Tolerance);
 
 		slim_opt(ts, 1);
-		project_surface_update_feature(mf, ts.fc, ts.V, ts.s, ts.sc, Projection_range);
+		project_features(ts, Projection_range);
 
 		ts.projection = true;
+		if (slim_converged(ts)) break;
 	}
 	ts.Vgroups.clear();
-	project_surface_update_feature(mf, ts.fc, ts.V, ts.s, ts.sc, Projection_range);
+	ts.local.rows_valid = false;
+	project_features(ts, Projection_range);
 
 	//====================post-update====================//
-	vector<bool> touchedV_flag(mesh.Vs.size(), false);
-	for (uint32_t i = 0; i < ts.T.rows(); i++)for (uint32_t j = 0; j < 4; j++)touchedV_flag[ts.T(i, j)] = true;
-	for (uint32_t i = 0; i < ts.b.rows(); i++) touchedV_flag[ts.b[i]] = true;
-	for (uint32_t i = 0; i < touchedV_flag.size(); i++) if (touchedV_flag[i] && V_map[i] != INVALID_V) {
-		mesh_.V.col(V_map[i]) = ts.V.row(i);
-	}
+	//every write is journaled, a rejected collapse gets the pre-collapse mesh back
+	auto write_v = [&](uint32_t vid, const Vector3d &v) {
+		journal.smoothed.push_back(make_pair(vid, Vector3F(mesh.V.col(vid))));
+		mesh.V.col(vid) = v.cast<Float>();
+	};
+	for (auto vid : ts.Reverse_V_map)
+		if (V_map[vid] != INVALID_V) write_v(V_map[vid], ts.V.row(vid).transpose());
 
 	for (uint32_t i = 0; i < CI.V_Groups.size(); i++) {
 		vector<uint32_t> &vs = CI.V_Groups[i];
 		uint32_t mv_id = V_map[CI.target_vs[i]];
-		mesh_.V.col(mv_id).setZero();
+		Vector3d center = Vector3d::Zero();
 		for (uint32_t j = 0; j < vs.size(); j++) {
-			mesh_.V.col(mv_id) += ts.V.row(vs[j]);
+			center += ts.V.row(vs[j]).transpose();
 			if (vs[j] != CI.target_vs[i]) V_map[vs[j]] = INVALID_V;
 		}
-		mesh_.V.col(mv_id) /= vs.size();
+		write_v(mv_id, center / vs.size());
 	}
 
-	scaled_jacobian(mesh_, mq);
+	scaled_jacobian(mesh, mq);
 
 	if (mq.min_Jacobian < Jacobian_Bound) {
+		rollback_collapse();
 		return false;
 	}
 
 	//assign fc 
 	Feature_Constraints fc_temp;
-	update_feature_variable_index_newmesh(ts, fc_temp, V_map, mesh_.Vs.size());
-	tetralize_mesh_omesh(ts, mesh_);
+	update_feature_variable_index_newmesh(ts, fc_temp, V_map, mesh.Vs.size());
+	tetralize_mesh_omesh(ts, mesh);
 	ts.fc = fc_temp;
 	ts.global = true;
 	ts.s.resize(0); ts.sc.resize(0, 3);
+	ts.local.rows_valid = false;
+	slim_ctrl.begin(Slim_Iteration);
 	for (uint32_t i = 0; i < Slim_Iteration; i++){
 		ts.projection = false;
 		//RT
-		compute_referenceMesh(ts.V, mesh_.Hs, CI.Hsregion, ts.RT);
+		compute_referenceMesh(ts.V, mesh.Hs, CI.Hsregion, ts.RT, ts.RT_cache, Reference_Tolerance);
 
 		slim_opt(ts, 1);
 
-		project_surface_update_feature(mf, ts.fc, ts.V, ts.s, ts.sc, Projection_range);
+		project_features(ts, Projection_range);
 		
 		ts.projection = true;
+		if (slim_converged(ts)) break;
 	}
-	project_surface_update_feature(mf, ts.fc, ts.V, ts.s, ts.sc, Projection_range);
+	project_features(ts, Projection_range);
 
-	std::fill(touchedV_flag.begin(), touchedV_flag.end(),false);
-	for (uint32_t i = 0; i < ts.T.rows(); i++)for (uint32_t j = 0; j < 4; j++)touchedV_flag[ts.T(i, j)] = true;
-	for (uint32_t i = 0; i < ts.b.rows(); i++) touchedV_flag[ts.b[i]] = true;
-	for (uint32_t i = 0; i < touchedV_flag.size(); i++) if (touchedV_flag[i]) {
-		mesh_.V.col(i) = ts.V.row(i);
-	}
+	for (auto vid : ts.Reverse_V_map) write_v(vid, ts.V.row(vid).transpose());
 
-	scaled_jacobian(mesh_, mq);
+	scaled_jacobian(mesh, mq);
 	if (mq.min_Jacobian < Jacobian_Bound) { std::cout << "double check smoothing" << endl;
-	return false;  system("PAUSE"); 
+	rollback_collapse(); return false;
 	}
 
-	if (!hausdorff_ratio_check(mf.tri, mesh_)) return false;
+	if (!hausdorff_ratio_check(mf.tri, mesh)) { rollback_collapse(); return false; }
 
 	fc = ts.fc;
 
-	mesh = mesh_;
-	si = si_;
-	frame = frame_;
+	commit_collapse();
+	si.swap(si_);
+	frame.swap(frame_);
+	if (low_memory) release_scratch();
 	
 	return true;
 }
 bool simplification::tetralize_mesh(Tetralize_Set &ts) {
 	//re-index
-	vector<bool> V_flag(mesh.Vs.size(), false), F_flag(mesh.Fs.size(), false), H_flag(mesh.Hs.size(), false);
+	Scratch_Scope scope(pool);
+	Epoch_Flags &F_flag = pool.flag(mesh.Fs.size()), &H_flag = pool.flag(mesh.Hs.size());
 	CI.fs_before.clear();
-	for (auto hid : CI.hs) H_flag[hid] = true;
+	for (auto hid : CI.hs) H_flag.set(hid);
 
 	for (auto hid : CI.hs) {
 		for (auto fid : mesh.Hs[hid].fs) if (!F_flag[fid] && !mesh.Fs[fid].boundary) {
 			uint32_t h0 = mesh.Fs[fid].neighbor_hs[0], h1 = mesh.Fs[fid].neighbor_hs[1];
 			if (H_flag[h0] != H_flag[h1]) {
-				CI.fs_before.push_back(fid); F_flag[fid] = true;
+				CI.fs_before.push_back(fid); F_flag.set(fid);
 			}
 		}
 	}
@@ -1691,16 +2460,13 @@ bool simplification::tetralize_mesh(Tetralize_Set &ts) {
 	grow_region2(CI.hs.size(), CI.fs_before, CI.before_region, Hsregion, ts, H_flag, mesh, false);
 	CI.Hsregion = Hsregion;
 	//V
-	ts.V = mesh.V.transpose();
+	ts.V = mesh.V.transpose().cast<double>();
 	//T
 	ts.T.resize(8 * Hsregion.size(), 4);
-	Vector4i t;
-	for (uint32_t k = 0; k < Hsregion.size();k++) {
-		auto h = mesh.Hs[Hsregion[k]];
-		for (uint32_t i = 0; i < 8; i++) {
-			for (uint32_t j = 0; j < 4; j++) t[j] = h.vs[hex_tetra_table[i][j]];
-			ts.T.row(8 * k + i) = t;
-		}
+	for (uint32_t k = 0; k < Hsregion.size(); k++) {
+		auto &h = mesh.Hs[Hsregion[k]];
+		for (uint32_t i = 0; i < 8; i++)
+			for (uint32_t j = 0; j < 4; j++) ts.T(8 * k + i, j) = h.vs[hex_tetra_table[i][j]];
 	}
 
 	uint32_t constraint_Num = 0;
@@ -1715,14 +2481,16 @@ bool simplification::tetralize_mesh(Tetralize_Set &ts) {
 			constraint_Num++;
 		}
 	}
+	localize_ts(ts);
 	return true;
 }
 bool simplification::tetralize_mesh_omesh(Tetralize_Set &ts, Mesh &mesh_r) {
 
-	ts.V = mesh_r.V.transpose();
+	ts.V = mesh_r.V.transpose().cast<double>();
 
-	vector<bool> V_flag(mesh_r.Vs.size(), false);
-	for (uint32_t i = 0; i < CI.target_vs.size();i++) V_flag[V_map[CI.target_vs[i]]] = true;
+	Scratch_Scope scope(pool);
+	Epoch_Flags &V_flag = pool.flag(mesh_r.Vs.size());
+	for (uint32_t i = 0; i < CI.target_vs.size();i++) V_flag.set(V_map[CI.target_vs[i]]);
 	
 	CI.fs_after.clear();
 	for (auto f : mesh_r.Fs) {
@@ -1732,72 +2500,59 @@ bool simplification::tetralize_mesh_omesh(Tetralize_Set &ts, Mesh &mesh_r) {
 	}
 
 	vector<uint32_t> Hsregion;
-	vector<bool> H_flag(mesh_r.Hs.size(), false);
+	Epoch_Flags &H_flag = pool.flag(mesh_r.Hs.size());
 	int base_num = CI.hs.size();
 	if (OPTIMIZATION_ONLY) base_num = mesh_r.Hs.size();
 	grow_region2(base_num, CI.fs_after, CI.after_region, Hsregion, ts, H_flag, mesh_r, true);
 	CI.Hsregion = Hsregion;
-	//T_
-	vector<vector<uint32_t>> T_;
-	vector<uint32_t> t(4);
-	for (auto hid : Hsregion) {
-		auto h = mesh_r.Hs[hid];
-		for (uint32_t i = 0; i < 8; i++) {
-			for (uint32_t j = 0; j < 4; j++) t[j] = h.vs[hex_tetra_table[i][j]];
-			T_.push_back(t);
-		}
-	}
 	//T
-	ts.T.resize(T_.size(), 4);
-	for (uint32_t i = 0; i < T_.size(); i++)  for (uint32_t j = 0; j < 4; j++) ts.T(i, j) = T_[i][j];
+	ts.T.resize(8 * Hsregion.size(), 4);
+	for (uint32_t k = 0; k < Hsregion.size(); k++) {
+		auto &h = mesh_r.Hs[Hsregion[k]];
+		for (uint32_t i = 0; i < 8; i++)
+			for (uint32_t j = 0; j < 4; j++) ts.T(8 * k + i, j) = h.vs[hex_tetra_table[i][j]];
+	}
 
 	ts.b.resize(0);
 	ts.bc.resize(0, 3); ts.bc.setZero();
+	localize_ts(ts);
 	return true;
 }
 bool simplification::tetralize_mesh_submesh(Tetralize_Set &ts, Mesh &mesh_r){
-	ts.V = mesh_r.V.transpose();
+	ts.V = mesh_r.V.transpose().cast<double>();
 
-	vector<bool> V_flag(mesh_r.Vs.size(), false), F_flag(mesh_r.Fs.size(), false), H_flag(mesh_r.Hs.size(), false);
+	Scratch_Scope scope(pool);
+	Epoch_Flags &F_flag = pool.flag(mesh_r.Fs.size()), &H_flag = pool.flag(mesh_r.Hs.size());
 	CI.fs_subdivided.clear();
-	for (auto hid : CI.hs) {
-		H_flag[hid] = true;
-		for (uint32_t i = 0; i < 8; i++) V_flag[mesh_r.Hs[hid].vs[i]] = true;
-	}
+	for (auto hid : CI.hs) H_flag.set(hid);
 	for (auto hid : CI.hs) {
 		for (auto fid : mesh_r.Hs[hid].fs) if (!F_flag[fid] && !mesh_r.Fs[fid].boundary) {
 			uint32_t h0 = mesh_r.Fs[fid].neighbor_hs[0], h1 = mesh_r.Fs[fid].neighbor_hs[1];
 			if (H_flag[h0] != H_flag[h1]) {
-				CI.fs_subdivided.push_back(fid); F_flag[fid] = true;
+				CI.fs_subdivided.push_back(fid); F_flag.set(fid);
 			}
 		}
 	}
-	for (auto fid : CI.fs_subdivided) F_flag[fid] = false;//but useless
 
 	vector<uint32_t> Hsregion;
 	grow_region2(CI.hs.size(), CI.fs_subdivided, CI.subd_region, Hsregion, ts, H_flag, mesh_r, true);
 	Hsregion.insert(Hsregion.end(), CI.hs.begin(), CI.hs.end());
 	CI.Hsregion = Hsregion;
 
-	//T_
-	vector<vector<uint32_t>> T_;
-	vector<uint32_t> t(4);
-	for (auto hid : Hsregion) {
-		auto h = mesh_r.Hs[hid];
-		for (uint32_t i = 0; i < 8; i++) {
-			for (uint32_t j = 0; j < 4; j++) t[j] = h.vs[hex_tetra_table[i][j]];
-			T_.push_back(t);
-		}
-	}
 	//T
-	ts.T.resize(T_.size(), 4);
-	for (uint32_t i = 0; i < T_.size(); i++)  for (uint32_t j = 0; j < 4; j++) ts.T(i, j) = T_[i][j];
+	ts.T.resize(8 * Hsregion.size(), 4);
+	for (uint32_t k = 0; k < Hsregion.size(); k++) {
+		auto &h = mesh_r.Hs[Hsregion[k]];
+		for (uint32_t i = 0; i < 8; i++)
+			for (uint32_t j = 0; j < 4; j++) ts.T(8 * k + i, j) = h.vs[hex_tetra_table[i][j]];
+	}
 
 	ts.b.resize(0);
 	ts.bc.resize(0, 3); ts.bc.setZero();
+	localize_ts(ts);
 	return true;
 }
-bool simplification::grow_region(uint32_t base_num, vector<uint32_t> &frontFs, vector<uint32_t> &regionFs, vector<uint32_t> &newHs, Tetralize_Set &ts, vector<bool> &H_flag, Mesh &mesh_r, bool global) {
+bool simplification::grow_region(uint32_t base_num, vector<uint32_t> &frontFs, vector<uint32_t> &regionFs, vector<uint32_t> &newHs, Tetralize_Set &ts, Epoch_Flags &H_flag, Mesh &mesh_r, bool global) {
 	
 	if (base_num <= 0) return false;
 	int upper_limit = 0; 
@@ -1809,14 +2564,15 @@ bool simplification::grow_region(uint32_t base_num, vector<uint32_t> &frontFs, v
 	}
 	if (upper_limit >= mesh_r.Hs.size()) {
 		upper_limit = mesh_r.Hs.size();
-		for (auto h : mesh_r.Hs) if (!H_flag[h.id]) newHs.push_back(h.id);
+		for (auto &h : mesh_r.Hs) if (!H_flag[h.id]) newHs.push_back(h.id);
 		ts.regionb.resize(0);
 		ts.regionbc.resize(0, 3);
 		regionFs.clear();
 		return true;
 	}
 	
-	vector<bool> F_flag(mesh_r.Fs.size(), false);
+	Scratch_Scope scope(pool);
+	Epoch_Flags &F_flag = pool.flag(mesh_r.Fs.size());
 	newHs.clear();	 
 	vector<uint32_t> FFs = frontFs;
 	bool newadded = false;
@@ -1824,19 +2580,19 @@ bool simplification::grow_region(uint32_t base_num, vector<uint32_t> &frontFs, v
 		newadded = false;
 		for (auto fid : FFs) {
 			for (auto hid : mesh_r.Fs[fid].neighbor_hs) if (!H_flag[hid]) {
-				H_flag[hid] = true;
+				H_flag.set(hid);
 				newHs.push_back(hid);
 				newadded = true;
 			}
 		}
-		for (auto fid : FFs)F_flag[fid] = true;
+		for (auto fid : FFs) F_flag.set(fid);
 		FFs.clear();
 		if (!newadded) break;
 		for (auto hid : newHs) {
 			for (auto fid : mesh_r.Hs[hid].fs)if (!F_flag[fid] && !mesh_r.Fs[fid].boundary) {
 				uint32_t h0 = mesh_r.Fs[fid].neighbor_hs[0], h1 = mesh_r.Fs[fid].neighbor_hs[1];
 				if (H_flag[h0] != H_flag[h1]) {
-					FFs.push_back(fid); F_flag[fid] = true;
+					FFs.push_back(fid); F_flag.set(fid);
 				}
 			}
 		}
@@ -1845,26 +2601,26 @@ bool simplification::grow_region(uint32_t base_num, vector<uint32_t> &frontFs, v
 	regionFs = FFs;
 
 	vector<uint32_t> vs;
-	vector<bool> V_flag(mesh_r.Vs.size(), false);
+	Epoch_Flags &V_flag = pool.flag(mesh_r.Vs.size());
 	for (auto fid : FFs) {
 		for (auto vid : mesh_r.Fs[fid].vs)
-			if (!V_flag[vid]) { vs.push_back(vid); V_flag[vid] = true; }
+			if (!V_flag[vid]) { vs.push_back(vid); V_flag.set(vid); }
 	}
 
 	ts.regionb.resize(vs.size());
 	ts.regionbc.resize(vs.size(), 3); ts.regionbc.setZero();
 	for (uint32_t i = 0; i < vs.size(); i++) {
 		ts.regionb[i] = vs[i];
-		ts.regionbc.row(i) = mesh_r.V.col(vs[i]);
+		ts.regionbc.row(i) = mesh_r.V.col(vs[i]).cast<double>();
 	}
 
 	return true;
 }
-bool simplification::grow_region2(uint32_t base_num, vector<uint32_t> &frontFs, vector<uint32_t> &regionFs, vector<uint32_t> &newHs, Tetralize_Set &ts, vector<bool> &H_flag, Mesh &mesh_r, bool global) {
+bool simplification::grow_region2(uint32_t base_num, vector<uint32_t> &frontFs, vector<uint32_t> &regionFs, vector<uint32_t> &newHs, Tetralize_Set &ts, Epoch_Flags &H_flag, Mesh &mesh_r, bool global) {
 
 	if (base_num <= 0) return false;
 	else if (base_num >= mesh_r.Hs.size()) {
-		for (auto h : mesh_r.Hs) if (!H_flag[h.id]) newHs.push_back(h.id);
+		for (auto &h : mesh_r.Hs) if (!H_flag[h.id]) newHs.push_back(h.id);
 		ts.regionb.resize(0);
 		ts.regionbc.resize(0, 3);
 		regionFs.clear();
@@ -1875,7 +2631,8 @@ bool simplification::grow_region2(uint32_t base_num, vector<uint32_t> &frontFs,
 	if (global) ringN = width_sheet * Slim_global_region;
 	else  ringN = width_sheet * Slim_region;
 
-	vector<bool> F_flag(mesh_r.Fs.size(), false);
+	Scratch_Scope scope(pool);
+	Epoch_Flags &F_flag = pool.flag(mesh_r.Fs.size());
 	newHs.clear();
 	vector<uint32_t> FFs = frontFs;
 	bool newadded = false;
@@ -1883,19 +2640,19 @@ bool simplification::grow_region2(uint32_t base_num, vector<uint32_t> &frontFs,
 		newadded = false;
 		for (auto fid : FFs) {
 			for (auto hid : mesh_r.Fs[fid].neighbor_hs) if (!H_flag[hid]) {
-				H_flag[hid] = true;
+				H_flag.set(hid);
 				newHs.push_back(hid);
 				newadded = true;
 			}
 		}
-		for (auto fid : FFs)F_flag[fid] = true;
+		for (auto fid : FFs) F_flag.set(fid);
 		FFs.clear();
 		if (!newadded) break;
 		for (auto hid : newHs) {
 			for (auto fid : mesh_r.Hs[hid].fs)if (!F_flag[fid] && !mesh_r.Fs[fid].boundary) {
 				uint32_t h0 = mesh_r.Fs[fid].neighbor_hs[0], h1 = mesh_r.Fs[fid].neighbor_hs[1];
 				if (H_flag[h0] != H_flag[h1]) {
-					FFs.push_back(fid); F_flag[fid] = true;
+					FFs.push_back(fid); F_flag.set(fid);
 				}
 			}
 		}
@@ -1904,17 +2661,17 @@ bool simplification::grow_region2(uint32_t base_num, vector<uint32_t> &frontFs,
 	regionFs = FFs;
 
 	vector<uint32_t> vs;
-	vector<bool> V_flag(mesh_r.Vs.size(), false);
+	Epoch_Flags &V_flag = pool.flag(mesh_r.Vs.size());
 	for (auto fid : FFs) {
 		for (auto vid : mesh_r.Fs[fid].vs)
-			if (!V_flag[vid]) { vs.push_back(vid); V_flag[vid] = true; }
+			if (!V_flag[vid]) { vs.push_back(vid); V_flag.set(vid); }
 	}
 
 	ts.regionb.resize(vs.size());
 	ts.regionbc.resize(vs.size(), 3); ts.regionbc.setZero();
 	for (uint32_t i = 0; i < vs.size(); i++) {
 		ts.regionb[i] = vs[i];
-		ts.regionbc.row(i) = mesh_r.V.col(vs[i]);
+		ts.regionbc.row(i) = mesh_r.V.col(vs[i]).cast<double>();
 	}
 
 	return true;
@@ -1955,6 +2712,7 @@ void simplification::update_feature_variable_index_newmesh(Tetralize_Set &ts, Fe
 			sc.row(S_num++) = ts.sc.row(i);
 		}
 		ts.s = s; ts.sc = sc;
+		ts.local.rows_valid = false;
 	}
 
 	fcc.ids_C.resize(C_num); fcc.C.resize(C_num, 3);
@@ -1988,118 +2746,127 @@ void simplification::update_feature_variable_index_newmesh(Tetralize_Set &ts, Fe
 }
 
 void simplification::slim_opt(Tetralize_Set &ts, const uint32_t iter) {
+	Timer<std::chrono::microseconds> timer;
+	if (Slim_Anderson && !slim_anderson) { slim_anderson = std::make_shared<igl::SLIMAnderson>(); slim_anderson->m = Slim_Anderson; }
+	slim_region(ts, iter, slim_pattern, Slim_Anderson ? slim_anderson : nullptr, slim_ctrl, 1000);
+	if (ts.local.T.rows()) {
+		double rate = timer.value() / 1000.0 / (ts.local.T.rows() * iter);
+		slim_ms_per_tet = slim_ms_per_tet == 0 ? rate : 0.8 * slim_ms_per_tet + 0.2 * rate;
+	}
+}
+void simplification::slim_region(Tetralize_Set &ts, const uint32_t iter, std::shared_ptr<igl::SLIMPattern> &pattern,
+	const std::shared_ptr<igl::SLIMAnderson> &anderson, Slim_Control &ctrl, size_t min_parallel) {
+	//reads the settings only, concurrent calls on different sets are safe
 	igl::SLIMData sData;
 
-	int vN = 0;
-	vector<int> mapV(ts.V.rows(), -1), mapRV;
-	vector<bool> touchedV_flag(ts.V.rows(), false);
-	for (uint32_t i = 0; i < ts.T.rows(); i++)for (uint32_t j = 0; j < 4; j++)touchedV_flag[ts.T(i, j)] = true;
-	for (uint32_t i = 0; i < ts.b.rows(); i++) touchedV_flag[ts.b[i]] = true;
-	for (uint32_t i = 0; i < touchedV_flag.size(); i++) if (touchedV_flag[i]) { mapV[i] = vN++; mapRV.push_back(i); }
-
-	Tetralize_Set ts_temp;
-	localize_ts(ts, ts_temp, vN, mapV, touchedV_flag);
+	localize_features(ts);
+	Tetralize_Local &lc = ts.local;
+	for (uint32_t i = 0; i < ts.Reverse_V_map.size(); i++) lc.V.row(i) = ts.V.row(ts.Reverse_V_map[i]);
 
 	sData.soft_const_p = 1e5;
 	sData.exp_factor = 5.0;
-	sData.lamda_C = ts_temp.fc.lamda_C;
-	sData.lamda_T = ts_temp.fc.lamda_T;
-	sData.lamda_L = ts_temp.fc.lamda_L;
-	sData.lamda_region = ts_temp.lamda_region;
-	sData.Vgroups = ts_temp.Vgroups;
+	sData.lamda_C = lc.fc.lamda_C;
+	sData.lamda_T = lc.fc.lamda_T;
+	sData.lamda_L = lc.fc.lamda_L;
+	sData.lamda_region = ts.lamda_region;
+	sData.Vgroups = lc.Vgroups;
+	sData.pattern = pattern;
+	sData.matrix_free = lc.T.rows() > Matrix_Free_Tets;
+	sData.anderson = anderson;
+	sData.min_parallel = min_parallel;
 
 	igl::SLIMData::SLIM_ENERGY energy = igl::SLIMData::SYMMETRIC_DIRICHLET;
 
-	if (ts_temp.projection)
-		slim_precompute(ts_temp.V, ts_temp.T, ts_temp.V, sData, energy, ts_temp.s, ts_temp.sc,
-			ts_temp.fc.ids_C, ts_temp.fc.C,
-			ts_temp.fc.ids_L, ts_temp.fc.Axa_L, ts_temp.fc.origin_L,
-			ts_temp.fc.ids_T, ts_temp.fc.normal_T, ts_temp.fc.dis_T, ts_temp.regionb, ts_temp.regionbc, ts_temp.projection, ts_temp.global, ts.RT);
+	if (ts.projection)
+		slim_precompute(lc.V, lc.T, lc.V, sData, energy, lc.s, lc.sc,
+			lc.fc.ids_C, lc.fc.C,
+			lc.fc.ids_L, lc.fc.Axa_L, lc.fc.origin_L,
+			lc.fc.ids_T, lc.fc.normal_T, lc.fc.dis_T, lc.regionb, ts.regionbc, ts.projection, ts.global, ts.RT);
 	else
-		slim_precompute(ts_temp.V, ts_temp.T, ts_temp.V, sData, energy, ts_temp.b, ts_temp.bc,
-			ts_temp.fc.ids_C, ts_temp.fc.C,
-			ts_temp.fc.ids_L, ts_temp.fc.Axa_L, ts_temp.fc.origin_L,
-			ts_temp.fc.ids_T, ts_temp.fc.normal_T, ts_temp.fc.dis_T, ts_temp.regionb, ts_temp.regionbc, ts_temp.projection, ts_temp.global, ts.RT);
+		slim_precompute(lc.V, lc.T, lc.V, sData, energy, lc.b, ts.bc,
+			lc.fc.ids_C, lc.fc.C,
+			lc.fc.ids_L, lc.fc.Axa_L, lc.fc.origin_L,
+			lc.fc.ids_T, lc.fc.normal_T, lc.fc.dis_T, lc.regionb, ts.regionbc, ts.projection, ts.global, ts.RT);
 
+	double energy0 = sData.energy;
 	slim_solve(sData, iter);
+	pattern = sData.pattern;
+	ctrl.decrease = energy0 > 0 ? (energy0 - sData.energy) / energy0 : 0;
+	ctrl.energy = sData.energy;
 
-	for (uint32_t i = 0; i < sData.V_o.rows(); i++) ts.V.row(mapRV[i]) = sData.V_o.row(i);
-}
-void simplification::localize_ts(Tetralize_Set &ts, Tetralize_Set &ts_temp, int &vN, vector<int> & mapV, vector<bool> & touchedV_flag) {
-	ts_temp.projection = ts.projection;
-	ts_temp.global = ts.global;
-
-	ts_temp.lamda_region = ts.lamda_region;
-
-	//V, T
-	ts_temp.V.resize(vN, 3); ts_temp.T = ts.T;
-	for (uint32_t i = 0; i < touchedV_flag.size(); i++) if (touchedV_flag[i]) {
-		ts_temp.V.row(mapV[i]) = ts.V.row(i);
-	}
-	for (uint32_t i = 0; i < ts.T.rows(); i++)for (uint32_t j = 0; j < 4; j++) ts_temp.T(i, j) = mapV[ts.T(i, j)];
-	//b, bc
-	ts_temp.b = ts.b; ts_temp.bc = ts.bc; vector<int> bb;
-	for (uint32_t i = 0; i < ts_temp.b.size(); i++) {
-		ts_temp.b[i] = mapV[ts_temp.b[i]];
-		bb.push_back(ts_temp.b[i]);
-	}
-	//Vgroups
-	ts_temp.Vgroups = ts.Vgroups;
-	for (uint32_t i = 0; i < ts_temp.Vgroups.size(); i++)for (uint32_t j = 0; j < ts_temp.Vgroups[i].size(); j++) ts_temp.Vgroups[i][j] = mapV[ts_temp.Vgroups[i][j]];
-	//regionb, regionbc
-	ts_temp.regionb = ts.regionb; ts_temp.regionbc = ts.regionbc;
-	for (uint32_t i = 0; i < ts_temp.regionb.size(); i++) ts_temp.regionb[i] = mapV[ts_temp.regionb[i]];
-	//s, sc
-	int sN = 0;
-	for (uint32_t i = 0; i < ts.s.size(); i++) if (touchedV_flag[ts.s[i]]) sN++;
-	ts_temp.s.resize(sN); ts_temp.sc.resize(sN, 3);
-	sN = 0;
-	for (uint32_t i = 0; i < ts.s.size(); i++)if (touchedV_flag[ts.s[i]]) {
-		ts_temp.s[sN] = mapV[ts.s[i]];
-		ts_temp.sc.row(sN) = ts.sc.row(i);
-		sN++;  
-	}
-
-	//fc
-	ts_temp.fc.lamda_C = ts.fc.lamda_C;
-	ts_temp.fc.lamda_T = ts.fc.lamda_T;
-	ts_temp.fc.lamda_L = ts.fc.lamda_L;
-
-	uint32_t C_num = 0, L_num = 0, T_num = 0;
-
-	for (uint32_t i = 0; i < ts.fc.V_types.size(); i++) if (touchedV_flag[i]) {
-		if (ts.fc.V_types[i] == Feature_V_Type::CORNER) C_num++;
-		else if (ts.fc.V_types[i] == Feature_V_Type::LINE) L_num++;
-		else if (ts.fc.V_types[i] == Feature_V_Type::REGULAR) T_num++;
-	}
-	ts_temp.fc.ids_C.resize(C_num); ts_temp.fc.C.resize(C_num, 3);
-	ts_temp.fc.num_a = L_num; ts_temp.fc.ids_L.resize(L_num); ts_temp.fc.Axa_L.resize(L_num, 3); ts_temp.fc.origin_L.resize(L_num, 3);
-	ts_temp.fc.ids_T.resize(T_num); ts_temp.fc.normal_T.resize(T_num, 3); ts_temp.fc.dis_T.resize(T_num);
-	C_num = L_num = T_num = 0;
-	for (uint32_t i = 0; i < ts.fc.ids_C.size(); i++) {
-		uint32_t vid = ts.fc.ids_C[i];
-		if (touchedV_flag[vid]) {
-			ts_temp.fc.ids_C[C_num] = mapV[vid];
-			ts_temp.fc.C.row(C_num++) = ts.fc.C.row(i);
-		}
+	ctrl.move = 0;
+	for (uint32_t i = 0; i < sData.V_o.rows(); i++) {
+		ctrl.move = std::max(ctrl.move, (sData.V_o.row(i) - lc.V.row(i)).norm());
+		ts.V.row(ts.Reverse_V_map[i]) = sData.V_o.row(i);
 	}
-	for (uint32_t i = 0; i < ts.fc.ids_L.size(); i++) {
-		uint32_t vid = ts.fc.ids_L[i];
-		if (touchedV_flag[vid]) {
-			ts_temp.fc.ids_L[L_num] = mapV[vid];
-			ts_temp.fc.Axa_L.row(L_num) = ts.fc.Axa_L.row(i);
-			ts_temp.fc.origin_L.row(L_num++) = ts.fc.origin_L.row(i);
-		}
-	}
-	for (uint32_t i = 0; i < ts.fc.ids_T.size(); i++) {
-		uint32_t vid = ts.fc.ids_T[i];
-		if (touchedV_flag[vid]) {
-			ts_temp.fc.ids_T[T_num] = mapV[vid];
-			ts_temp.fc.normal_T.row(T_num) = ts.fc.normal_T.row(i);
-			ts_temp.fc.dis_T.row(T_num++) = ts.fc.dis_T.row(i);
-		}
+}
+void simplification::localize_ts(Tetralize_Set &ts) {
+	//region numbering in first-touch order over the tets, then the collapse targets
+	Tetralize_Local &lc = ts.local;
+	ts.V_map.assign(ts.V.rows(), INVALID_V);
+	ts.Reverse_V_map.clear();
+	auto number = [&](uint32_t vid) {
+		if (ts.V_map[vid] != INVALID_V) return;
+		ts.V_map[vid] = ts.Reverse_V_map.size(); ts.Reverse_V_map.push_back(vid);
+	};
+	for (uint32_t i = 0; i < ts.T.rows(); i++)for (uint32_t j = 0; j < 4; j++) number(ts.T(i, j));
+	for (uint32_t i = 0; i < ts.b.size(); i++) number(ts.b[i]);
+
+	lc.V.resize(ts.Reverse_V_map.size(), 3);
+	lc.T.resize(ts.T.rows(), 4);
+	for (uint32_t i = 0; i < ts.T.rows(); i++)for (uint32_t j = 0; j < 4; j++) lc.T(i, j) = ts.V_map[ts.T(i, j)];
+	lc.b.resize(ts.b.size());
+	for (uint32_t i = 0; i < ts.b.size(); i++) lc.b[i] = ts.V_map[ts.b[i]];
+	lc.regionb.resize(ts.regionb.size());
+	for (uint32_t i = 0; i < ts.regionb.size(); i++) lc.regionb[i] = ts.V_map[ts.regionb[i]];
+	lc.rows_valid = false;
+}
+void simplification::localize_features(Tetralize_Set &ts) {
+	Tetralize_Local &lc = ts.local;
+	Feature_Constraints &fc = ts.fc, &lfc = lc.fc;
+	auto inside = [&](uint32_t vid) { return vid < ts.V_map.size() && ts.V_map[vid] != INVALID_V; };
+	//the constrained rows are rebuilt after a new tetralization and wherever ts.fc, ts.s or ts.Vgroups are reassigned,
+	//which clears rows_valid; otherwise only the targets are gathered
+	if (!lc.rows_valid) {
+		lc.s_rows.clear(); lc.C_rows.clear(); lc.L_rows.clear(); lc.T_rows.clear();
+		for (uint32_t i = 0; i < ts.s.size(); i++) if (inside(ts.s[i])) lc.s_rows.push_back(i);
+		for (uint32_t i = 0; i < fc.ids_C.size(); i++) if (inside(fc.ids_C[i])) lc.C_rows.push_back(i);
+		for (uint32_t i = 0; i < fc.ids_L.size(); i++) if (inside(fc.ids_L[i])) lc.L_rows.push_back(i);
+		for (uint32_t i = 0; i < fc.ids_T.size(); i++) if (inside(fc.ids_T[i])) lc.T_rows.push_back(i);
+
+		lc.s.resize(lc.s_rows.size()); lc.sc.resize(lc.s_rows.size(), 3);
+		for (uint32_t i = 0; i < lc.s_rows.size(); i++) lc.s[i] = ts.V_map[ts.s[lc.s_rows[i]]];
+		lfc.ids_C.resize(lc.C_rows.size()); lfc.C.resize(lc.C_rows.size(), 3);
+		for (uint32_t i = 0; i < lc.C_rows.size(); i++) lfc.ids_C[i] = ts.V_map[fc.ids_C[lc.C_rows[i]]];
+		lfc.num_a = lc.L_rows.size(); lfc.ids_L.resize(lc.L_rows.size()); lfc.Axa_L.resize(lc.L_rows.size(), 3); lfc.origin_L.resize(lc.L_rows.size(), 3);
+		for (uint32_t i = 0; i < lc.L_rows.size(); i++) lfc.ids_L[i] = ts.V_map[fc.ids_L[lc.L_rows[i]]];
+		lfc.ids_T.resize(lc.T_rows.size()); lfc.normal_T.resize(lc.T_rows.size(), 3); lfc.dis_T.resize(lc.T_rows.size());
+		for (uint32_t i = 0; i < lc.T_rows.size(); i++) lfc.ids_T[i] = ts.V_map[fc.ids_T[lc.T_rows[i]]];
+
+		lc.Vgroups = ts.Vgroups;
+		for (auto &g : lc.Vgroups) for (auto &vid : g) vid = ts.V_map[vid];
+
+		lc.rows_valid = true;
+	}
+	//targets of this round, region-sized gathers
+	lfc.lamda_C = fc.lamda_C; lfc.lamda_T = fc.lamda_T; lfc.lamda_L = fc.lamda_L;
+	for (uint32_t i = 0; i < lc.s_rows.size(); i++) lc.sc.row(i) = ts.sc.row(lc.s_rows[i]);
+	for (uint32_t i = 0; i < lc.C_rows.size(); i++) lfc.C.row(i) = fc.C.row(lc.C_rows[i]);
+	for (uint32_t i = 0; i < lc.L_rows.size(); i++) {
+		lfc.Axa_L.row(i) = fc.Axa_L.row(lc.L_rows[i]);
+		lfc.origin_L.row(i) = fc.origin_L.row(lc.L_rows[i]);
+	}
+	for (uint32_t i = 0; i < lc.T_rows.size(); i++) {
+		lfc.normal_T.row(i) = fc.normal_T.row(lc.T_rows[i]);
+		lfc.dis_T[i] = fc.dis_T[lc.T_rows[i]];
 	}
 }
+void simplification::project_features(Tetralize_Set &ts, uint32_t range) {
+	//the projection rewrites s but keeps its ids unless s was reset or ts.fc reassigned, then only the targets move
+	VectorXi s_before = ts.s;
+	project_surface_update_feature(mf, ts.fc, ts.V, ts.s, ts.sc, range);
+	if (s_before.size() != ts.s.size() || s_before != ts.s) ts.local.rows_valid = false;
+}
 
 void simplification::subdivision() {
 	if (Hex_Num_Threshold >= mesh.Hs.size()) {
@@ -2162,7 +2929,7 @@ bool simplification::hex_mesh_subdivision() {
 
 		uint32_t num = 2; Vector3d vd; vd.setZero();
 		for (uint32_t j = 0; j < num; j++)
-			vd += mesh.V.col(mesh.Es[i].vs[j]);
+			vd += mesh.V.col(mesh.Es[i].vs[j]).cast<double>();
 		vd /= num;
 		V_.push_back(vd);
 		Hybrid_V hv;
@@ -2179,7 +2946,7 @@ bool simplification::hex_mesh_subdivision() {
 
 		uint32_t num = 4; Vector3d vd; vd.setZero();
 		for (uint32_t j = 0; j < num; j++)
-			vd += mesh.V.col(mesh.Fs[i].vs[j]);
+			vd += mesh.V.col(mesh.Fs[i].vs[j]).cast<double>();
 		vd /= num;
 		V_.push_back(vd);
 		Hybrid_V hv;
@@ -2203,7 +2970,7 @@ bool simplification::hex_mesh_subdivision() {
 
 		uint32_t num = 8; Vector3d vd; vd.setZero();
 		for (uint32_t j = 0; j < num; j++)
-			vd += mesh.V.col(mesh.Hs[i].vs[j]);
+			vd += mesh.V.col(mesh.Hs[i].vs[j]).cast<double>();
 		vd /= num;
 		V_.push_back(vd);
 		Hybrid_V hv;
@@ -2227,10 +2994,6 @@ bool simplification::hex_mesh_subdivision() {
 		if (H_map[i] < INVALID_ELE) {
 
 			const vector<uint32_t> &vs = mesh.Hs[i].vs;
-			for (auto vid:vs) {
-				std::sort(mesh.Vs[vid].neighbor_es.begin(), mesh.Vs[vid].neighbor_es.end());
-				std::sort(mesh.Vs[vid].neighbor_fs.begin(), mesh.Vs[vid].neighbor_fs.end());
-			}
 			for (uint32_t j = 0; j < 8; j++) {
 				Hybrid h;
 				h.id = H_id++;
@@ -2238,21 +3001,21 @@ bool simplification::hex_mesh_subdivision() {
 				for (uint32_t k = 0; k < 8; k++) {
 					if (k == j) continue;
 					//sharedes
-					vector<uint32_t> sharedes;
-					std::set_intersection(mesh.Vs[vs[k]].neighbor_es.begin(), mesh.Vs[vs[k]].neighbor_es.end(),
-						mesh.Vs[vs[j]].neighbor_es.begin(), mesh.Vs[vs[j]].neighbor_es.end(), back_inserter(sharedes));
-					if (sharedes.size()) {
-						if (sharedes.size() != 1 || E_map[sharedes[0]] == INVALID_ELE) { system("PAUSE"); }
-						h.vs[k] = E_map[sharedes[0]];
+					uint32_t sharede = vs_lookup(mesh.E_index, vs_key(vs[k], vs[j]));
+					if (sharede != INVALID_E) {
+						if (E_map[sharede] == INVALID_ELE) { system("PAUSE"); }
+						h.vs[k] = E_map[sharede];
 						continue;
 					}
-					//sharedfs
-					vector<uint32_t> sharedfs;
-					std::set_intersection(mesh.Vs[vs[k]].neighbor_fs.begin(), mesh.Vs[vs[k]].neighbor_fs.end(),
-						mesh.Vs[vs[j]].neighbor_fs.begin(), mesh.Vs[vs[j]].neighbor_fs.end(), back_inserter(sharedfs));
-					if (sharedfs.size()) {
-						if (sharedfs.size() != 1 || F_map[sharedfs[0]] == INVALID_ELE) { system("PAUSE"); }
-						h.vs[k] = F_map[sharedfs[0]];
+					//sharedfs, the face of this hex holding both corners
+					uint32_t sharedf = INVALID_ELE;
+					for (auto fid : mesh.Hs[i].fs) {
+						const vector<uint32_t> &fvs = mesh.Fs[fid].vs;
+						if (std::find(fvs.begin(), fvs.end(), vs[k]) != fvs.end() && std::find(fvs.begin(), fvs.end(), vs[j]) != fvs.end()) { sharedf = fid; break; }
+					}
+					if (sharedf != INVALID_ELE) {
+						if (F_map[sharedf] == INVALID_ELE) { system("PAUSE"); }
+						h.vs[k] = F_map[sharedf];
 						continue;
 					}
 					//hex-diagonal v
@@ -2274,8 +3037,6 @@ bool simplification::hex_mesh_subdivision() {
 			const vector<uint32_t> &hvs = mesh.Hs[i].vs;
 			vector<uint32_t> &fvs = mesh.Fs[fs[0]].vs;
 
-			for (auto vid : hvs) std::sort(mesh.Vs[vid].neighbor_es.begin(), mesh.Vs[vid].neighbor_es.end());
-			
 			for (uint32_t j = 0; j < 4; j++) {
 				uint32_t v0_fix = fvs[j], v1_fix = INVALID_ELE;
 				for (auto vid : mesh.Vs[v0_fix].neighbor_vs)
@@ -2293,23 +3054,19 @@ bool simplification::hex_mesh_subdivision() {
 
 					if (std::find(mesh.Fs[fs[0]].vs.begin(), mesh.Fs[fs[0]].vs.end(), hvs[k]) != mesh.Fs[fs[0]].vs.end()) {
 						//sharedes
-						vector<uint32_t> sharedes;
-						std::set_intersection(mesh.Vs[v0_fix].neighbor_es.begin(), mesh.Vs[v0_fix].neighbor_es.end(),
-							mesh.Vs[hvs[k]].neighbor_es.begin(), mesh.Vs[hvs[k]].neighbor_es.end(), back_inserter(sharedes));
-						if (sharedes.size()) {
-							if (sharedes.size() != 1 || E_map[sharedes[0]] == INVALID_ELE) {system("PAUSE"); }
-							h.vs[k] = E_map[sharedes[0]];
+						uint32_t sharede = vs_lookup(mesh.E_index, vs_key(v0_fix, hvs[k]));
+						if (sharede != INVALID_E) {
+							if (E_map[sharede] == INVALID_ELE) { system("PAUSE"); }
+							h.vs[k] = E_map[sharede];
 							continue;
 						}else h.vs[k] = F_map[fs[0]];
 
 					}else if(std::find(mesh.Fs[fs[1]].vs.begin(), mesh.Fs[fs[1]].vs.end(), hvs[k]) != mesh.Fs[fs[1]].vs.end()) {
 						//sharedes
-						vector<uint32_t> sharedes;
-						std::set_intersection(mesh.Vs[v1_fix].neighbor_es.begin(), mesh.Vs[v1_fix].neighbor_es.end(),
-							mesh.Vs[hvs[k]].neighbor_es.begin(), mesh.Vs[hvs[k]].neighbor_es.end(), back_inserter(sharedes));
-						if (sharedes.size()) {
-							if (sharedes.size() != 1 || E_map[sharedes[0]] == INVALID_ELE) {system("PAUSE"); }
-							h.vs[k] = E_map[sharedes[0]];
+						uint32_t sharede = vs_lookup(mesh.E_index, vs_key(v1_fix, hvs[k]));
+						if (sharede != INVALID_E) {
+							if (E_map[sharede] == INVALID_ELE) { system("PAUSE"); }
+							h.vs[k] = E_map[sharede];
 							continue;
 						}
 						else h.vs[k] = F_map[fs[1]];
@@ -2331,8 +3088,6 @@ bool simplification::hex_mesh_subdivision() {
 		else {
 			const vector<uint32_t> &hvs = mesh.Hs[i].vs;
 
-			for (auto vid : hvs) std::sort(mesh.Vs[vid].neighbor_es.begin(), mesh.Vs[vid].neighbor_es.end());
-
 			for (uint32_t j = 0; j < 2; j++) {
 				vector<uint32_t> &fvs = mesh.Fs[fs[j]].vs;
 
@@ -2343,12 +3098,10 @@ bool simplification::hex_mesh_subdivision() {
 					if (std::find(fvs.begin(), fvs.end(), hvs[k]) != fvs.end()) { h.vs[k] = hvs[k]; continue; }
 
 					for (auto vid : fvs) {
-						vector<uint32_t> sharedes;
-						std::set_intersection(mesh.Vs[vid].neighbor_es.begin(), mesh.Vs[vid].neighbor_es.end(),
-							mesh.Vs[hvs[k]].neighbor_es.begin(), mesh.Vs[hvs[k]].neighbor_es.end(), back_inserter(sharedes));
-						if (sharedes.size()) {
-							if (sharedes.size() != 1 || E_map[sharedes[0]] == INVALID_ELE) { system("PAUSE"); }
-							h.vs[k] = E_map[sharedes[0]];
+						uint32_t sharede = vs_lookup(mesh.E_index, vs_key(vid, hvs[k]));
+						if (sharede != INVALID_E) {
+							if (E_map[sharede] == INVALID_ELE) { system("PAUSE"); }
+							h.vs[k] = E_map[sharede];
 							break;
 						}
 					}
@@ -2360,10 +3113,11 @@ bool simplification::hex_mesh_subdivision() {
 	}
 	mesh_.V.resize(3, mesh_.Vs.size()); mesh_.V.setZero();
 	mesh_.V.block(0, 0, 3, mesh.V.cols()) = mesh.V;
-	for (uint32_t i = 0; i < V_.size(); i++) mesh_.V.col(mesh.V.cols() + i) = V_[i];
+	for (uint32_t i = 0; i < V_.size(); i++) mesh_.V.col(mesh.V.cols() + i) = V_[i].cast<Float>();
 	for (auto h:mesh_.Hs) for (uint32_t k = 0; k < 8; k++)mesh_.Vs[h.vs[k]].neighbor_hs.push_back(h.id);
 	
-	Mesh mesh_temp = mesh_;
+	//mesh_ is scratch: work on it in place instead of copying
+	Mesh &mesh_temp = mesh_;
 	build_connectivity(mesh_temp);
 	Mesh_Quality mq;
 	scaled_jacobian(mesh_temp, mq);
@@ -2461,28 +3215,28 @@ bool simplification::hex_mesh_subdivision() {
 			ts.insert(ts.end(), tids_.begin(), tids_.end()); tids_.clear();
 			sort(ts.begin(), ts.end()); ts.erase(unique(ts.begin(), ts.end()), ts.end());
 		}
-		Vector3d v = mesh_.V.col(E_map[i]), interpolP, interpolN; double dis = 0;
+		Vector3d v = mesh_.V.col(E_map[i]).cast<double>(), interpolP, interpolN; double dis = 0;
 		uint32_t tid = -1;
 		Vector3d PreinterpolP, PreinterpolN;
 		PreinterpolP.setZero(); PreinterpolN.setZero();
-		if (phong_projection(ts, subdivision_project_range, tid, v, interpolP, interpolN, PreinterpolP, PreinterpolN)) {
+		if (phong_projection(mf, ts, subdivision_project_range, tid, v, interpolP, interpolN, PreinterpolP, PreinterpolN)) {
 			if ((v - interpolP).norm() >= mf.ave_length) {
 				tid = 0;
-				double min_dis = (v - mf.Tcenters[0]).norm();
+				double min_dis = (v - mf.Tcenters[0].cast<double>()).norm();
 				for (uint32_t j = 1; j < mf.Tcenters.size(); j++) {
-					if (min_dis >(v - mf.Tcenters[j]).norm()) {
+					if (min_dis >(v - mf.Tcenters[j].cast<double>()).norm()) {
 						tid = j;
-						min_dis = (v - mf.Tcenters[j]).norm();
+						min_dis = (v - mf.Tcenters[j].cast<double>()).norm();
 					}
 				}
 				uint32_t tid_temp = tid;
 				ts.clear();
 				ts.push_back(tid_temp);
-				if (phong_projection(ts, subdivision_project_range, tid_temp, v, interpolP, interpolN, PreinterpolP, PreinterpolN))
+				if (phong_projection(mf, ts, subdivision_project_range, tid_temp, v, interpolP, interpolN, PreinterpolP, PreinterpolN))
 					tid = tid_temp;
 				else {
-					interpolP = mf.Tcenters[tid_temp];
-					interpolN = mf.normal_Tri.col(tid_temp);
+					interpolP = mf.Tcenters[tid_temp].cast<double>();
+					interpolN = mf.normal_Tri.col(tid_temp).cast<double>();
 				}
 			}
 		}
@@ -2535,28 +3289,28 @@ bool simplification::hex_mesh_subdivision() {
 			ts.insert(ts.end(), tids_.begin(), tids_.end()); tids_.clear();
 			sort(ts.begin(), ts.end()); ts.erase(unique(ts.begin(), ts.end()), ts.end());
 		}
-		Vector3d v = mesh_.V.col(F_map[i]), interpolP, interpolN; double dis = 0;
+		Vector3d v = mesh_.V.col(F_map[i]).cast<double>(), interpolP, interpolN; double dis = 0;
 		uint32_t tid = -1;
 		Vector3d PreinterpolP, PreinterpolN;
 		PreinterpolP.setZero(); PreinterpolN.setZero();
-		if (phong_projection(ts, subdivision_project_range, tid, v, interpolP, interpolN, PreinterpolP, PreinterpolN)) {
+		if (phong_projection(mf, ts, subdivision_project_range, tid, v, interpolP, interpolN, PreinterpolP, PreinterpolN)) {
 			if ((v - interpolP).norm() >= mf.ave_length) {
 				tid = 0;
-				double min_dis = (v - mf.Tcenters[0]).norm();
+				double min_dis = (v - mf.Tcenters[0].cast<double>()).norm();
 				for (uint32_t j = 1; j < mf.Tcenters.size(); j++) {
-					if (min_dis >(v - mf.Tcenters[j]).norm()) {
+					if (min_dis >(v - mf.Tcenters[j].cast<double>()).norm()) {
 						tid = j;
-						min_dis = (v - mf.Tcenters[j]).norm();
+						min_dis = (v - mf.Tcenters[j].cast<double>()).norm();
 					}
 				}
 				uint32_t tid_temp = tid;
 				ts.clear();
 				ts.push_back(tid_temp);
-				if (phong_projection(ts, subdivision_project_range, tid_temp, v, interpolP, interpolN, PreinterpolP, PreinterpolN))
+				if (phong_projection(mf, ts, subdivision_project_range, tid_temp, v, interpolP, interpolN, PreinterpolP, PreinterpolN))
 					tid = tid_temp;
 				else {
-					interpolP = mf.Tcenters[tid_temp];
-					interpolN = mf.normal_Tri.col(tid_temp);
+					interpolP = mf.Tcenters[tid_temp].cast<double>();
+					interpolN = mf.normal_Tri.col(tid_temp).cast<double>();
 				}
 			}
 		}
@@ -2589,31 +3343,30 @@ bool simplification::hex_mesh_subdivision() {
 	}
 
 	Feature_Constraints fc_temp = fc_;
-	MatrixXd v_temp = mesh_.V.transpose(), sc_temp;
+	MatrixXd v_temp = mesh_.V.transpose().cast<double>(), sc_temp;
 	VectorXi s_temp;
 	project_surface_update_feature(mf, fc_temp, v_temp, ts.s, ts.sc, subdivision_project_range);	
 ///////////////////////////////////optimize////////////////////////////
 	tetralize_mesh_submesh(ts, mesh_temp);
 	ts.fc = fc_temp;
+	ts.local.rows_valid = false;
 	ts.global = true;
 
+	slim_ctrl.begin(Slim_Iteration);
 	for (uint32_t i = 0; i < Slim_Iteration; i++) {
 		ts.projection = false;
 
 		//RT
-		compute_referenceMesh(ts.V, mesh_temp.Hs, CI.Hsregion, ts.RT);
+		compute_referenceMesh(ts.V, mesh_temp.Hs, CI.Hsregion, ts.RT, ts.RT_cache, Reference_Tolerance);
 
 		slim_opt(ts, 1);
 
-		project_surface_update_feature(mf, ts.fc, ts.V, ts.s, ts.sc, Projection_range);
+		project_features(ts, Projection_range);
 		ts.projection = true;
+		if (slim_converged(ts)) break;
 	}
 
-	vector<bool> touchedV_flag(mesh_temp.Vs.size(), false);
-	for (uint32_t i = 0; i < ts.T.rows(); i++)for (uint32_t j = 0; j < 4; j++)touchedV_flag[ts.T(i, j)] = true;
-	for (uint32_t i = 0; i < touchedV_flag.size(); i++) if (touchedV_flag[i]) {
-		mesh_temp.V.col(i) = ts.V.row(i);
-	}
+	for (auto vid : ts.Reverse_V_map) mesh_temp.V.col(vid) = ts.V.row(vid).cast<Float>();
 
 	scaled_jacobian(mesh_temp, mq);
 	if (mq.min_Jacobian < Jacobian_Bound) {
@@ -2621,10 +3374,8 @@ bool simplification::hex_mesh_subdivision() {
 	}
 
 	if (!hausdorff_ratio_check(mf.tri, mesh_temp)) return false;
-	mesh_.V = mesh_temp.V;
 	fc = ts.fc;
-	mesh = mesh_;
-	build_connectivity(mesh);
+	mesh.swap(mesh_temp);
 	base_com.singularity_structure(si, mesh);
 	base_com.base_complex_extraction(si, frame, mesh);
 
@@ -2644,8 +3395,8 @@ uint32_t simplification::nearest_tid(vector<uint32_t> &ts, const Vector3d &v, Ve
 		vector<Vector3d> tri_vs(3), vs_normals(3);
 		vector<uint32_t> &vs = mf.tri.Fs[ts[j]].vs;
 		for (uint32_t k = 0; k < 3; k++) {
-			tri_vs[k] = mf.tri.V.col(vs[k]);
-			vs_normals[k] = mf.normal_V.col(vs[k]);
+			tri_vs[k] = mf.tri.V.col(vs[k]).cast<double>();
+			vs_normals[k] = mf.normal_V.col(vs[k]).cast<double>();
 		}
 		Vector2d uv;
 		projectPointOnTriangle(tri_vs, vs_normals, v, uv, interpolP, interpolN);
@@ -2668,11 +3419,11 @@ uint32_t simplification::nearest_tid(vector<uint32_t> &ts, const Vector3d &v, Ve
 			vector<uint32_t> &vs = mf.tri.Fs[ts[j]].vs;
 			Vector3d cv; cv.setZero();
 			double dis = 0;
-			for (uint32_t k = 0; k < 3; k++) cv += mf.tri.V.col(vs[k]);
+			for (uint32_t k = 0; k < 3; k++) cv += mf.tri.V.col(vs[k]).cast<double>();
 			cv /= 3;
 			dis = (cv - v).norm();
 			dis_ids.push_back(make_pair(dis, j));
-			pvs.push_back(cv); pns.push_back(mf.normal_Tri.col(ts[j]));
+			pvs.push_back(cv); pns.push_back(mf.normal_Tri.col(ts[j]).cast<double>());
 		}
 		sort(dis_ids.begin(), dis_ids.end());
 		tid = ts[dis_ids[0].second];
@@ -2720,4 +3471,42 @@ bool simplification::hausdorff_ratio_check(Mesh &m0, Mesh &m1) {
 			return false;
 		}
 		return true;
-}
\ No newline at end of file
+}
+void simplification::memory_report(const char *stage) {
+	const double MB = 1024.0 * 1024.0;
+	size_t bytes = memory_bytes();
+	std::cout << "memory (" << stage << "): this job holds " << bytes / MB << "MB (peak " << memory_peak / MB << "MB), peak RSS of the process " << peak_rss_bytes() / MB << "MB" << endl;
+	std::cout << "  mesh " << mesh_bytes(mesh) / MB << "MB, si " << singularity_bytes(si) / MB << "MB, frame " << frame_bytes(frame) / MB << "MB" << endl;
+	std::cout << "  mesh_ " << mesh_bytes(mesh_) / MB << "MB, si_ " << singularity_bytes(si_) / MB << "MB, frame_ " << frame_bytes(frame_) / MB << "MB" << endl;
+	std::cout << "  ts " << tetralize_bytes(ts) / MB << "MB, reference surface " << mesh_bytes(mf.tri) / MB << "MB, scratch " << scratch_bytes(pool) / MB << "MB" << endl;
+}
+size_t simplification::memory_bytes() {
+	size_t bytes = mesh_bytes(mesh) + singularity_bytes(si) + frame_bytes(frame)
+		+ mesh_bytes(mesh_) + singularity_bytes(si_) + frame_bytes(frame_)
+		+ tetralize_bytes(ts) + mesh_bytes(mf.tri) + scratch_bytes(pool);
+	memory_peak = std::max(memory_peak, bytes);
+	return bytes;
+}
+void simplification::check_memory_budget() {
+	if (!memory_budget || low_memory || memory_bytes() <= memory_budget) return;
+	//from now on: drop scratch copies after each commit and optimize smaller regions
+	low_memory = true;
+	memory_report("budget exceeded");
+	Slim_region = std::max(1.0, Slim_region / 2);
+	Slim_global_region = std::max(1.0, Slim_global_region / 2);
+	//smaller regions may accept what the larger ones rejected
+	Rejected.clear();
+	release_scratch();
+}
+void simplification::release_scratch() {
+	Mesh().swap(mesh_);
+	Singularity().swap(si_);
+	Frame().swap(frame_);
+	double lamda_region = ts.lamda_region;
+	ts = Tetralize_Set();
+	ts.lamda_region = lamda_region;
+	vector<Mesh_Quality>().swap(statistics);
+	slim_pattern.reset();
+	slim_anderson.reset();
+	if (!pool.flags_used && !pool.lists_used) pool = Scratch_Pool();
+}
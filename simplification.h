@@ -16,6 +16,7 @@
 #include <algorithm>
 #include "igl/slim.h"
 #include "metro_hausdorff.h"
+#include "timer.h"
 
 class simplification
 {
@@ -47,6 +48,7 @@ public:
 		fc.lamda_T = 1e+3;
 		ts.lamda_region = 1e+7;
 		last_candidate_pos = 0;
+		path_out[0] = '\0';
 	};
 	~simplification() {};
 
@@ -60,18 +62,45 @@ public:
 	void set_hausdorff_ratio(double ratio) { hausdorff_ratio_threshould = ratio; }
 	void set_target_hex_num(uint32_t hex_num) {Hex_Num_Threshold = hex_num;}
 	void set_slim_region(double ratio) {Slim_region = ratio;if (Slim_region < 0) Slim_region = 0; Slim_global_region = Slim_region * 2;}
+	void set_memory_budget(size_t MB) { memory_budget = MB * 1024 * 1024; }
+	void set_batch_size(uint32_t n) { Batch_Size = n < 1 ? 1 : n; }
+	void set_filter_adaptive(bool adaptive) { Filter_Adaptive = adaptive; }
+	void set_predict_jacobian_bound(double bound) { Predict_Jacobian_Bound = bound; }
+	void set_deadline(size_t ms) { deadline_ms = ms; deadline_clock.reset(); }
+	void set_slim_adaptive(bool adaptive) { Slim_Adaptive = adaptive; }
+	void set_matrix_free_tets(uint32_t n) { Matrix_Free_Tets = n; }
+	void set_reference_tolerance(double tolerance) { Reference_Tolerance = tolerance; }
+	void set_slim_anderson(uint32_t window) { Slim_Anderson = window; slim_anderson.reset(); }
+	void set_domain_decomposition(uint32_t halo) { DD_Halo = halo; }
+	void set_quality_target(double min_J) { Quality_Target = min_J; }
+	void set_multilevel(bool multilevel) { Multilevel = multilevel; }
 
 	void extract();
 	bool build_sheet_info(uint32_t sheet_id);
 	CHord extract_chord(uint32_t &fid, vector<bool> &f_flag);
 	bool build_chord_info(uint32_t id);
+	uint32_t cuboid_face(uint32_t hid, const vector<uint32_t> &vs);
 
 	void ranking();
 	void sheet_chord_weight(Tuple_Candidate &c);
 	void dihedral_angle(Float &angle, Float &k_ratio, vector<uint32_t> &cs, uint32_t eid);
 
 	bool remove();
-	bool filter_topology_feature(Tuple_Candidate &c);
+	uint32_t remove_batch();
+	void candidate_parameters(Tuple_Candidate &c);
+	uint64_t candidate_signature(Tuple_Candidate &c);
+	void collapse_region(const vector<uint32_t> &core_hs, vector<uint32_t> &region_hs);
+	bool filter_topology_feature(Tuple_Candidate &c, uint64_t &key);
+	bool filter_feature(Tuple_Candidate &c, uint64_t &key);
+	bool rejected_before(Tuple_Candidate &c, uint64_t &key);
+	bool filter_cascade(Tuple_Candidate &c, bool topology, uint64_t &key);
+	bool filter_stage(Filter_Stage s, Tuple_Candidate &c);
+	bool predict_jacobian();
+	void filter_report();
+	double remaining_ms();
+	double optimization_estimate();
+	bool time_for(double ms);
+	bool slim_converged(Tetralize_Set &ts);
 	bool vs_pair_sheet(uint32_t sheet_id, vector<vector<uint32_t>> &candiate_es_links, vector<vector<uint32_t>> &v_group);
 	bool target_surface_sheet(uint32_t sheet_id, vector<vector<uint32_t>> &candiate_es_links, vector<vector<uint32_t>> &v_group);
 
@@ -79,25 +108,46 @@ public:
 	bool target_surface_chord(uint32_t chord_id);
 
 	bool topology_check();
+	bool apply_collapse();
+	void rollback_collapse();
+	void commit_collapse();
 	bool hausdorff_ratio_check(Mesh &m0, Mesh &m1);
 
 	void optimization();
+	void optimization_dd();
+	void optimization_local();
+	bool optimization_coarse();
+	bool cuboid_parameters(vector<uint32_t> &cuboid, MatrixXd &W);
+	void build_subdomains(vector<Subdomain> &subs);
+	void setup_subdomain(Subdomain &sd, const vector<uint32_t> &hs, vector<uint32_t> &local);
+	void localize_subdomain(Subdomain &sd, vector<uint32_t> &local);
+	void smooth_subdomain(Subdomain &sd, const Feature_Constraints &fcc, const MatrixXd &V_in, MatrixXd &V_out,
+		bool projection, const vector<uint32_t> &s_row, const MatrixXd &sc, size_t min_parallel);
+	void slim_benchmark(double tolerance = 1.e-4);
 	bool direct_collapse();
 	bool tetralize_mesh(Tetralize_Set &ts);
 	bool tetralize_mesh_omesh(Tetralize_Set &ts, Mesh &mesh_r);
 	bool tetralize_mesh_submesh(Tetralize_Set &ts, Mesh &mesh_r);
-	bool grow_region(uint32_t base_num, vector<uint32_t> &frontFs, vector<uint32_t> &regionFs, vector<uint32_t> &newHs, Tetralize_Set &ts, vector<bool> &H_flag, Mesh &mesh_r, bool global);
-	bool grow_region2(uint32_t base_num, vector<uint32_t> &frontFs, vector<uint32_t> &regionFs, vector<uint32_t> &newHs, Tetralize_Set &ts, vector<bool> &H_flag, Mesh &mesh_r, bool global);
+	bool grow_region(uint32_t base_num, vector<uint32_t> &frontFs, vector<uint32_t> &regionFs, vector<uint32_t> &newHs, Tetralize_Set &ts, Epoch_Flags &H_flag, Mesh &mesh_r, bool global);
+	bool grow_region2(uint32_t base_num, vector<uint32_t> &frontFs, vector<uint32_t> &regionFs, vector<uint32_t> &newHs, Tetralize_Set &ts, Epoch_Flags &H_flag, Mesh &mesh_r, bool global);
 	void update_feature_variable_index_newmesh(Tetralize_Set &ts, Feature_Constraints &fc,
 		vector<uint32_t> &new_V_map, uint32_t new_Vsize);
 
 	void slim_opt(Tetralize_Set &ts, const uint32_t iter);
-	void localize_ts(Tetralize_Set &ts, Tetralize_Set &ts_temp, int &vN, vector<int> & mapV, vector<bool> & touchedV_flag);
+	void slim_region(Tetralize_Set &ts, const uint32_t iter, std::shared_ptr<igl::SLIMPattern> &pattern,
+		const std::shared_ptr<igl::SLIMAnderson> &anderson, Slim_Control &ctrl, size_t min_parallel);
+	void localize_ts(Tetralize_Set &ts);
+	void localize_features(Tetralize_Set &ts);
+	void project_features(Tetralize_Set &ts, uint32_t range);
 
 	void subdivision();
 	bool hex_mesh_subdivision();
 	uint32_t nearest_tid(vector<uint32_t> &ts, const Vector3d &v, Vector3d &n, Vector3d &pv, double &dis);
 
+	void memory_report(const char *stage);
+	void check_memory_budget();
+	void release_scratch();
+
 	double cuboid_num_original;
 	double sheet_num_original;
 
@@ -121,10 +171,59 @@ public:
 	int32_t Projection_range, Projection_limit, subdivision_project_range;
 	std::vector<Sheet> All_Sheets;
 	std::vector<CHord> All_Chords;
+	//frame edge -> sheet id, rebuilt by extract()
+	std::vector<uint32_t> FE_sheet;
 	std::vector<Tuple_Candidate> Candidates;
 
 	uint32_t last_candidate_pos;
+	uint32_t Batch_Size = 1;//non-interfering candidates collapsed per iteration, 1: sequential
+	//signatures of rejected candidates, a collapse or subdivision nearby changes the signature
+	std::unordered_set<uint64_t> Rejected;
+	uint32_t rejected_skips = 0;
+	//per-stage counters of the candidate filters, drive the adaptive stage order
+	Filter_Counter filter_counters[FILTER_NUM];
+	bool Filter_Adaptive = true;//false: stages run in Filter_Stage order
+	double Predict_Jacobian_Bound = -1;//the smoothing may untangle, -1: off
+	vector<vector<uint32_t>> sheet_es_links, sheet_v_group;//vs_pair_sheet -> target_surface_sheet
+
+	//anytime mode: wall-clock budget from set_deadline, 0: none
+	size_t deadline_ms = 0;
+	Timer<> deadline_clock;
+	//recent costs: one candidate evaluation, extract+ranking+subdivision, a slim iteration per tet
+	double candidate_ms = 0, update_ms = 0, slim_ms_per_tet = 0;
+
+	//smoothing rounds stop once converged or stalled, false: always run the fixed counts
+	bool Slim_Adaptive = true;
+	Slim_Control slim_ctrl;
+	//system matrix pattern of the last solve, reused while the localized tet set is the same
+	std::shared_ptr<igl::SLIMPattern> slim_pattern;
+	//larger solves (e.g. the global optimization) apply the system matrix tet by tet instead of assembling it
+	uint32_t Matrix_Free_Tets = 400000;
+	//Anderson window of the SLIM iterations, 0: plain local-global iterations
+	uint32_t Slim_Anderson = 0;
+	std::shared_ptr<igl::SLIMAnderson> slim_anderson;
+	//OPT: hex rings around each base-complex cuboid, solved concurrently color by color; 0: one global solve
+	uint32_t DD_Halo = 0;
+	//OPT: only regions around the hexes below this minimum scaled jacobian are smoothed, until none is left; 0: global
+	double Quality_Target = 0;
+	//OPT: smooth the base complex as a coarse hex mesh first and interpolate its nodes into the cuboids, then a few fine passes
+	bool Multilevel = false;
+	//reference cuboids are rebuilt for hexes whose corners moved more than this times their edge length
+	double Reference_Tolerance = 1.e-3;
+
+	//flag/list scratch reused across candidates, acquire under a Scratch_Scope
+	Scratch_Pool pool;
+
+	size_t memory_budget = 0;//bytes, 0: unlimited
+	//bytes held by this instance's structures, concurrent jobs of the process do not count in it
+	size_t memory_peak = 0;
+	size_t memory_bytes();
+	bool low_memory = false;
 public:
+	//per-job context, no state is shared between instances
+	Mesh_Feature mf;
+	char path_out[300];
+
 	h_io io;
 	Singularity si;
 	Frame frame;
@@ -134,11 +233,12 @@ public:
 	Mesh_Topology mt;
 	Tetralize_Set ts;
 	Collapse_Info CI;
+	Collapse_Journal journal;
 
 	Singularity si_;
 	Frame frame_;
 	Mesh mesh_;
-	vector<uint32_t> V_map, RV_map;
+	vector<uint32_t> V_map;
 
 	vector<Mesh_Quality> statistics;
 	int output_file_interval = 1;